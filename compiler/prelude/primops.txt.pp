@@ -2162,6 +2162,19 @@ primop  TraceEventOp "traceEvent#" GenPrimOp
    has_side_effects = True
    out_of_line      = True
 
+primop  SetTraceClassesOp "setTraceClasses#" GenPrimOp
+   Word# -> Word# -> State# s -> (# State# s, Word# #)
+   { Switches eventlog trace classes on and off while the program runs:
+     enables the classes in the first mask, then disables those in the
+     second, and returns the classes that were enabled before.  The bits
+     are those of {\tt rts\_setTraceClasses()} in {\tt RtsAPI.h}:
+     1 scheduler, 2 GC, 4 sampled sparks, 8 full sparks, 16 user
+     events.  Nothing can be enabled unless tracing was turned on at
+     startup with {\tt +RTS -l} or {\tt -v}. }
+   with
+   has_side_effects = True
+   out_of_line      = True
+
 ------------------------------------------------------------------------
 ---                                                                  ---
 ------------------------------------------------------------------------
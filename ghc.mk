@@ -621,6 +621,7 @@ endif
 
 BUILD_DIRS += utils/count_lines
 BUILD_DIRS += utils/compare_sizes
+BUILD_DIRS += utils/eventlog-index
 
 ifneq "$(CLEANING)" "YES"
 # After compiler/, because these packages depend on it
@@ -69,6 +69,28 @@ typedef struct {
 // you can't do that in C (it generates code).
 extern const RtsConfig defaultRtsConfig;
 
+/* ----------------------------------------------------------------------------
+   Eventlog sinks
+
+   By default the eventlog (+RTS -l) is written to <prog>.eventlog.  A C
+   host can send it somewhere else, e.g. straight to a collector process,
+   by registering a sink before calling hs_init().  write() gets
+   consecutive chunks of the log and returns HS_BOOL_FALSE on failure;
+   flush() and close() may be NULL.  The callbacks may be called from any
+   OS thread, but never concurrently.  A chunk that can't be written is
+   dropped, and after a few failures in a row the sink is closed.  The
+   struct is copied.
+   ------------------------------------------------------------------------- */
+
+typedef struct {
+    void   *user;       // passed to each of the callbacks
+    HsBool (*write) (void *user, void *data, HsWord size);
+    void   (*flush) (void *user);
+    void   (*close) (void *user);
+} EventLogSink;
+
+extern void rts_setEventLogSink (const EventLogSink *sink);
+
 /* ----------------------------------------------------------------------------
    Starting up and shutting down the Haskell RTS.
    ------------------------------------------------------------------------- */
@@ -220,6 +242,31 @@ void rts_checkSchedStatus (char* site, Capability *);
 
 SchedulerStatus rts_getSchedStatus (Capability *cap);
 
+/* ----------------------------------------------------------------------------
+   Eventlog flight recorder (+RTS -l --eventlog-ring=<size>)
+
+   Write the events currently kept in memory to <prog>.flight-<n>.eventlog.
+   Does nothing unless the flight recorder is enabled.
+   ------------------------------------------------------------------------- */
+void rts_dumpEventLog (void);
+
+/* ----------------------------------------------------------------------------
+   Switching eventlog trace classes on and off while the program runs
+
+   rts_setTraceClasses() enables the classes in 'on' and then disables
+   those in 'off', and returns the classes that were enabled before.
+   The classes correspond to the +RTS -l<flags>.  Nothing can be enabled
+   unless tracing was turned on at startup (+RTS -l or -v); in that case
+   the result is 0.  Also available to Haskell as setTraceClasses#.
+   ------------------------------------------------------------------------- */
+#define RTS_TRACE_SCHEDULER      0x1    /* s */
+#define RTS_TRACE_GC             0x2    /* g */
+#define RTS_TRACE_SPARKS_SAMPLED 0x4    /* p */
+#define RTS_TRACE_SPARKS_FULL    0x8    /* f */
+#define RTS_TRACE_USER           0x10   /* u */
+
+HsWord rts_setTraceClasses (HsWord on, HsWord off);
+
 /* --------------------------------------------------------------------------
    Wrapper closures
 
@@ -277,6 +277,13 @@
  */
 #define TSO_SQUEEZED 128
 
+/*
+ * TSO_EXPORTED: the thread is waiting in its Capability's queue of
+ * threads that other Capabilities may steal (see exportThread()).  It
+ * is ThreadMigrating until someone takes it from there.
+ */
+#define TSO_EXPORTED 256
+
 /* -----------------------------------------------------------------------------
    RET_DYN stack frames
    -------------------------------------------------------------------------- */
@@ -34,7 +34,10 @@
  * ----------
  *
  * log : EVENT_HEADER_BEGIN
+ *       [EVENT_HEADER_FLAGS Word32]   -- only if any flag is set
+ *       EVENT_HET_BEGIN
  *       EventType*
+ *       EVENT_HET_END
  *       EVENT_HEADER_END
  *       EVENT_DATA_BEGIN
  *       Event*
@@ -58,6 +61,55 @@
  *       ... extra event-specific info ...
  *
  *
+ * Compact blocks
+ * --------------
+ *
+ * If EVENT_HEADER_FLAG_COMPACT is set in the header flags, all events
+ * following an EVENT_BLOCK_MARKER, up to the end of its block, are
+ * encoded as CompactEvent instead.  The block marker itself, and the
+ * EVENT_DATA_END marker, keep the format above, so that a reader can
+ * still skip whole blocks.
+ *
+ * CompactEvent :
+ *       ULEB128        -- event_type
+ *       ULEB128        -- time (nanosecs) since the block marker's time
+ *       ULEB128        -- length of the rest in bytes
+ *       ... extra event-specific info ...
+ *
+ * For fixed-size events, each field of the event-specific info (as
+ * listed in the format above, e.g. thread, status and blockinfo for
+ * EVENT_STOP_THREAD) is written as the ULEB128 encoding of its
+ * unsigned value.  The info of variable-size events is written
+ * unchanged.
+ *
+ * ULEB128 is the unsigned LEB128 encoding: 7 bits per byte, least
+ * significant group first, top bit set on all bytes but the last.
+ *
+ *
+ * Index
+ * -----
+ *
+ * The EVENT_DATA_END marker may be followed by an index of the blocks
+ * in the log (see +RTS --eventlog-index, and utils/eventlog-index):
+ *
+ * Index :
+ *       EVENT_INDEX_BEGIN
+ *       Word32         -- number of entries
+ *       IndexEntry*
+ *       Word64         -- offset of EVENT_INDEX_BEGIN in the file
+ *       EVENT_INDEX_END
+ *
+ * IndexEntry :
+ *       Word64         -- offset of the EVENT_BLOCK_MARKER in the file
+ *       Word16         -- capability, 0xffff for events of no capability
+ *       Word64         -- time of the block marker (nanosecs)
+ *       Word64         -- end_time of the block marker
+ *
+ * Entries are in file order, so the blocks of a capability are sorted
+ * by time.  A reader finds the index from the last 12 bytes of the file.
+ * The index is left out if a write to the file failed.
+ *
+ *
  * To add a new event
  * ------------------
  *
@@ -82,9 +134,16 @@
 #define EVENT_HEADER_BEGIN    0x68647262 /* 'h' 'd' 'r' 'b' */
 #define EVENT_HEADER_END      0x68647265 /* 'h' 'd' 'r' 'e' */
 
+#define EVENT_HEADER_FLAGS    0x68666c67 /* 'h' 'f' 'l' 'g' */
+
+#define EVENT_HEADER_FLAG_COMPACT 0x1    /* compact blocks, see above */
+
 #define EVENT_DATA_BEGIN      0x64617462 /* 'd' 'a' 't' 'b' */
 #define EVENT_DATA_END        0xffff
 
+#define EVENT_INDEX_BEGIN     0x69647862 /* 'i' 'd' 'x' 'b' */
+#define EVENT_INDEX_END       0x69647865 /* 'i' 'd' 'x' 'e' */
+
 /*
  * Markers for begin/end of the list of Event Types in the Header.
  * Header, Event Type, Begin = hetb
@@ -143,8 +202,17 @@
 #define EVENT_INTERN_STRING       42 /* (string, id) {not used by ghc} */
 #define EVENT_WALL_CLOCK_TIME     43 /* (capset, unix_epoch_seconds, nanoseconds) */
 #define EVENT_THREAD_LABEL        44 /* (thread, name_string)  */
-
-/* Range 45 - 59 is available for new GHC and common events */
+#define EVENT_TSC_CALIBRATION     45 /* (ticks_per_sec, tsc)   */
+/* sizes in bytes; the par_* figures are 0 for a sequential GC */
+#define EVENT_GC_STATS            46 /* (gen, alloc, copied, live, slop,
+                                         par_n_threads, par_max_copied,
+                                         par_tot_copied) */
+#define EVENT_GC_GEN_STATS        47 /* (gen, size, live, slop, large) */
+#define EVENT_GC_THREAD_STATS     48 /* (gc_thread, copied, scanned,
+                                         any_work, no_work, scav_find_work) */
+#define EVENT_THREAD_BLOCKED      49 /* (thread, reason, object, owner,
+                                         thread_cap) */
+#define EVENT_THREAD_UNBLOCKED    50 /* (thread, object, waker, thread_cap) */
 
 #define EVENT_HPC_MODULE          51 /* (name, boxes, hash)    */
 #define EVENT_TICK_DUMP           52 /* (freqs, counts)        */
@@ -161,6 +229,49 @@
  * see http://www.mathematik.uni-marburg.de/~eden/
  */
 
+/* Instruction pointer samples counted per procedure (+RTS
+ * --eventlog-symbolize). A procedure is given by its start address, as
+ * in EVENT_DEBUG_PTR_RANGE; address 0 counts the samples outside of
+ * any known procedure.
+ */
+#define EVENT_PROC_SAMPLES        81 /* (cnt * (proc, samples)) */
+
+/* Instruction pointer samples with the values of a group of hardware
+ * counters (+RTS -Eg). counters gives the counters that are present, in
+ * the order of the PERF_COUNTER_* bits. The values are totals since the
+ * counters were started; the differences between consecutive samples
+ * give the counts for the code around the earlier sample's ip.
+ */
+#define EVENT_PERF_SAMPLE         82 /* (cap, counters,
+                                         cnt * (ip, values)) */
+
+/* The Haskell stack of a running thread, sampled on a timer tick (+RTS
+ * --eventlog-stack-sample). The frames are the info pointers of the
+ * return frames, innermost first; with tables-next-to-code they are
+ * code addresses, which the debug data maps to procedures.
+ */
+#define EVENT_STACK_SAMPLE        83 /* (thread, cnt * frame) */
+
+/* Cache and TLB misses counted by a GC thread in one phase of a GC
+ * (+RTS -Ep), see the GC_PHASE_* values.
+ */
+#define EVENT_GC_PHASE_COUNTERS   84 /* (gc_thread, phase, cache_misses,
+                                         dtlb_misses) */
+
+/* What the hardware counters counted while a thread ran (+RTS -Et),
+ * posted right after its EVENT_STOP_THREAD.
+ */
+#define EVENT_THREAD_COUNTERS     85 /* (thread, cycles, instructions,
+                                         cache_misses) */
+
+/* How often a capability found its thread evaluating the code of an
+ * info table (+RTS --info-table-samples), posted at exit. For a thunk
+ * or function being entered it's the closure's info table, otherwise
+ * the return frame's; like the frames of EVENT_STACK_SAMPLE they are
+ * code addresses with tables-next-to-code.
+ */
+#define EVENT_INFO_TABLE_SAMPLES  86 /* (cap, cnt * (info, samples)) */
+
 /* Range 100 - 139 is reserved for Mercury */
 
 /*
@@ -168,7 +279,7 @@
  * ranges higher than this are reserved but not currently emitted by ghc.
  * This must match the size of the EventDesc[] array in EventLog.c
  */
-#define NUM_GHC_EVENT_TAGS        60
+#define NUM_GHC_EVENT_TAGS        87
 
 #if 0  /* DEPRECATED EVENTS: */
 /* we don't actually need to record the thread, it's implicit */
@@ -213,6 +324,26 @@
 #define CAPSET_TYPE_OSPROCESS   2  /* caps belong to the same OS process */
 #define CAPSET_TYPE_CLOCKDOMAIN 3  /* caps share a local clock/time      */
 
+/*
+ * Counter bits for EVENT_PERF_SAMPLE
+ */
+#define PERF_COUNTER_CYCLES        0x1
+#define PERF_COUNTER_INSTRUCTIONS  0x2
+#define PERF_COUNTER_CACHE_MISSES  0x4  /* last level cache */
+#define PERF_COUNTER_BRANCH_MISSES 0x8
+#define PERF_COUNTER_DTLB_MISSES   0x10 /* data TLB, loads */
+
+/*
+ * GC phases for EVENT_GC_PHASE_COUNTERS
+ */
+#define GC_PHASE_ROOTS     0  /* mutable lists, capabilities, CAFs, ... */
+#define GC_PHASE_SCAVENGE  1  /* scavenging until there's no work left */
+#define GC_PHASE_WEAK      2  /* traversing the weak pointers */
+#define GC_PHASE_COMPACT   3  /* compacting or sweeping the oldest gen */
+#define GC_PHASE_NURSERY   4  /* clearing and resetting the nurseries */
+#define GC_PHASE_OTHER     5  /* the rest of the GC */
+#define NUM_GC_PHASES      6
+
 #ifndef EVENTLOG_CONSTANTS_ONLY
 
 typedef StgWord16 EventTypeNum;
@@ -103,6 +103,9 @@ struct PROFILING_FLAGS {
     nat                 heapProfileIntervalTicks; /* ticks between samples (derived) */
     rtsBool             includeTSOs;
 
+    rtsBool             infoTableSamples; /* time profile by info table,
+                                           * see InfoTableProf.c */
+
 
     rtsBool		showCCSOnException;
 
@@ -124,6 +127,12 @@ struct PROFILING_FLAGS {
 #define TRACE_EVENTLOG  1
 #define TRACE_STDERR    2
 
+/* Where the eventlog goes (TRACE_FLAGS.sink) */
+#define EVENTLOG_SINK_FILE   0  /* <prog>.eventlog */
+#define EVENTLOG_SINK_FD     1  /* an inherited file descriptor */
+#define EVENTLOG_SINK_PIPE   2  /* a named pipe */
+#define EVENTLOG_SINK_SOCKET 3  /* a Unix domain socket */
+
 struct TRACE_FLAGS {
     int tracing;
     rtsBool timestamp;      /* show timestamp in stderr output */
@@ -132,6 +141,21 @@ struct TRACE_FLAGS {
     rtsBool sparks_sampled; /* trace spark events by a sampled method */
     rtsBool sparks_full;    /* trace spark events 100% accurately */
     rtsBool user;           /* trace user events (emitted from Haskell code) */
+    rtsBool asyncWriter;    /* write the eventlog from a background thread */
+    nat     asyncBuffers;   /* spare buffers for the background writer */
+    lnat    ringSize;       /* flight recorder: bytes kept per buffer, or 0 */
+    nat     sink;           /* EVENTLOG_SINK_* */
+    int     sinkFd;         /* EVENTLOG_SINK_FD */
+    char   *sinkPath;       /* EVENTLOG_SINK_PIPE, EVENTLOG_SINK_SOCKET */
+    rtsBool compact;        /* delta timestamps and ULEB128 fields */
+    lnat    rotateSize;     /* start a new eventlog file after this many bytes */
+    Time    rotateTime;     /* ... or after this long, units: TIME_RESOLUTION */
+    rtsBool index;          /* append an index of the blocks to the eventlog */
+    rtsBool tsc;            /* timestamps from the TSC, where possible */
+    rtsBool symbolize;      /* count IP samples per procedure (USE_DWARF) */
+    char   *dwarfCache;     /* directory to cache debug data in (USE_DWARF) */
+    rtsBool dwarfAsync;     /* load debug data in the background (USE_DWARF) */
+    nat     stackSampleDepth; /* frames per stack sample, 0: no samples */
 };
 
 struct CONCURRENT_FLAGS {
@@ -154,6 +178,8 @@ struct MISC_FLAGS {
     rtsBool machineReadable;
     StgWord linkerMemBase;       /* address to ask the OS for memory
                                   * for the linker, NULL ==> off */
+    rtsBool perfMap;             /* write /tmp/perf-<pid>.map for the
+                                  * code the linker loads */
 };
 
 #ifdef THREADED_RTS
@@ -217,8 +243,15 @@ struct PERF_EVENT_FLAGS {
 	nat     sampleType;
 	nat     samplePeriod;
 #endif
+	/* Cache and TLB misses per GC phase (-Ep) */
+	rtsBool gcPhases;
+	/* Cycles, instructions and cache misses per Haskell thread (-Et) */
+	rtsBool threadCounters;
 };
 
+#define PERF_EVENT_SAMPLE_IP    1 /* -E:  instruction pointers */
+#define PERF_EVENT_SAMPLE_GROUP 2 /* -Eg: ... and a group of counters */
+
 #endif
 
 /* Put them together: */
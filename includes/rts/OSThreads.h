@@ -201,6 +201,7 @@ void  freeThreadLocalKey (ThreadLocalKey *key);
 
 // Processors and affinity
 void setThreadAffinity     (nat n, nat m);
+nat  getProcessorPackage   (nat cpu);
 #endif // !CMINUSMINUS
 
 #else
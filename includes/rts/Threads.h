@@ -41,6 +41,12 @@ StgRegTable * resumeThread  (void *);
 int    cmp_thread      (StgPtr tso1, StgPtr tso2);
 int    rts_getThreadId (StgPtr tso);
 
+// The cycles, instructions and cache misses counted while the thread
+// ran (+RTS -Et).  Returns false if they aren't counted.
+HsBool rts_getThreadCounters (StgPtr tso, HsWord64 *cycles,
+                              HsWord64 *instructions,
+                              HsWord64 *cache_misses);
+
 #if !defined(mingw32_HOST_OS)
 pid_t  forkProcess     (HsStablePtr *entry);
 #else
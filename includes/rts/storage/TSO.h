@@ -168,6 +168,16 @@ typedef struct StgTSO_ {
      */
     StgWord32  tot_stack_size;
 
+    /*
+     * Hardware counters, summed over the times this thread ran (+RTS
+     * -Et), see rts_getThreadCounters().  Always there, even when the
+     * RTS is built without perf_event support, so that the layout of
+     * a TSO is the same for code built outside the RTS.
+     */
+    StgWord64  perf_cycles;
+    StgWord64  perf_instructions;
+    StgWord64  perf_cache_misses;
+
 } *StgTSOPtr;
 
 typedef struct StgStack_ {
@@ -74,13 +74,57 @@ globalWorkToDo (void)
 #endif
 
 #if defined(THREADED_RTS)
+// Rounds of stealing in findSpark while we keep losing races with
+// other thieves, backing off for longer before each
+#define FIND_SPARK_ROUNDS 8
+
+// Picks the capability to start stealing at (xorshift)
+static nat
+stealStart (Capability *cap)
+{
+  StgWord32 x = cap->steal_rand;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  cap->steal_rand = x;
+  return x % n_capabilities;
+}
+
+static StgClosure *
+stealSparkFrom (Capability *cap, Capability *robbed, rtsBool *retry)
+{
+  StgClosurePtr spark;
+
+  if (emptySparkPoolCap(robbed)) // nothing to steal here
+      return NULL;
+
+  // take a batch, so that we don't have to come back for every spark
+  spark = tryStealSparks(robbed->sparks, cap->sparks);
+  while (spark != NULL && fizzledSpark(spark)) {
+      cap->spark_stats.fizzled++;
+      traceEventSparkFizzle(cap);
+      spark = tryStealSparks(robbed->sparks, cap->sparks);
+  }
+  if (spark == NULL && !emptySparkPoolCap(robbed)) {
+      // we conflicted with another thread while trying to steal;
+      // try again later.
+      *retry = rtsTrue;
+  }
+
+  if (spark != NULL) {
+      cap->spark_stats.converted++;
+      traceEventSparkSteal(cap, robbed->no);
+  }
+  return spark;
+}
+
 StgClosure *
 findSpark (Capability *cap)
 {
   Capability *robbed;
   StgClosurePtr spark;
   rtsBool retry;
-  nat i = 0;
+  nat i, start, pass, round = 0;
 
   if (!emptyRunQueue(cap) || cap->returning_tasks_hd != NULL) {
       // If there are other threads, don't try to run any new
@@ -94,7 +138,9 @@ findSpark (Capability *cap)
 
       // first try to get a spark from our own pool.
       // We should be using reclaimSpark(), because it works without
-      // needing any atomic instructions:
+      // needing any atomic instructions while the pool has at least
+      // WSDEQUE_STEAL_MAX sparks (it takes the newest one then, and
+      // the oldest one with a cas below that, like a thief):
       //   spark = reclaimSpark(cap->sparks);
       // However, measurements show that this makes at least one benchmark
       // slower (prsa) and doesn't affect the others.
@@ -122,35 +168,38 @@ findSpark (Capability *cap)
                  "cap %d: Trying to steal work from other capabilities", 
                  cap->no);
 
-      /* visit cap.s 0..n-1 in sequence until a theft succeeds. We could
-      start at a random place instead of 0 as well.  */
-      for ( i=0 ; i < n_capabilities ; i++ ) {
-          robbed = &capabilities[i];
-          if (cap == robbed)  // ourselves...
-              continue;
-
-          if (emptySparkPoolCap(robbed)) // nothing to steal here
-              continue;
-
-          spark = tryStealSpark(robbed->sparks);
-          while (spark != NULL && fizzledSpark(spark)) {
-              cap->spark_stats.fizzled++;
-              traceEventSparkFizzle(cap);
-              spark = tryStealSpark(robbed->sparks);
-          }
-          if (spark == NULL && !emptySparkPoolCap(robbed)) {
-              // we conflicted with another thread while trying to steal;
-              // try again later.
-              retry = rtsTrue;
+      /* visit the other cap.s until a theft succeeds, starting at a
+         random one so that idle cap.s don't all go for the same
+         victims, and going for the ones on our own package (sharing
+         its cache) before the others. */
+      start = stealStart(cap);
+      for ( pass = 0 ; pass < 2 ; pass++ ) {
+          for ( i = 0 ; i < n_capabilities ; i++ ) {
+              robbed = &capabilities[(start + i) % n_capabilities];
+              if (cap == robbed)  // ourselves...
+                  continue;
+
+              // nearby ones in the first pass, the others in the second
+              if ((robbed->steal_domain == cap->steal_domain) != (pass == 0))
+                  continue;
+
+              spark = stealSparkFrom(cap, robbed, &retry);
+              if (spark != NULL) {
+                  return spark;
+              }
+              // otherwise: no success, try next one
           }
+      }
 
-          if (spark != NULL) {
-              cap->spark_stats.converted++;
-              traceEventSparkSteal(cap, robbed->no);
-              
-              return spark;
+      if (retry && ++round < FIND_SPARK_ROUNDS) {
+          // back off before we go for the contended pools again
+          for (i = 0; i < (32U << round); i++) {
+              busy_wait_nop();
           }
-          // otherwise: no success, try next one
+      } else {
+          // If we keep losing, give up for now: the scheduler tries
+          // again while anySparks()
+          retry = rtsFalse;
       }
   } while (retry);
 
@@ -174,6 +223,129 @@ anySparks (void)
     }
     return rtsFalse;
 }
+
+/* -----------------------------------------------------------------------------
+ * Stealing threads
+ *
+ * Giving threads to other Capabilities is otherwise up to the one that
+ * has them (schedulePushWork()), which only gets round to it in its
+ * scheduler loop.  To let a burst of forkIO spread straight away, a
+ * new thread goes on a work-stealing deque instead of the run queue,
+ * and a free Capability is woken up to steal it.
+ *
+ * Whoever takes a thread from the deque owns it, which may also be
+ * the Capability that exported it (reclaimExportedThreads()).  Until
+ * then the thread is ThreadMigrating with TSO_EXPORTED set, and
+ * tso->cap is still the exporting Capability, which is the only one
+ * that will act on it: others send it messages.  A thief sets tso->cap
+ * before anything else, so that when the exporter reads tso->cap after
+ * the other fields it can tell whether the thread is still its own
+ * (see throwToMsg()).
+ *
+ * The exporter takes back what nobody stole when its run queue is
+ * empty, when no other Capability is free to steal, and before GC, so
+ * the deques are empty while the GC runs.
+ * -------------------------------------------------------------------------- */
+
+static void
+takeExportedThread (Capability *cap, StgTSO *tso)
+{
+    Capability *exporter;
+
+    ASSERT(tso->why_blocked == ThreadMigrating);
+    ASSERT(tso->flags & TSO_EXPORTED);
+
+    exporter = tso->cap;
+    tso->cap = cap;
+    write_barrier();
+    tso->why_blocked = NotBlocked;
+    tso->flags &= ~TSO_EXPORTED;
+
+    // The exporter is running and owns its event buffer, so we post
+    // the migration to ours, as with spark steals and thread wakeups.
+    if (exporter != cap) {
+        traceEventMigrateThread (cap, tso, cap->no);
+    }
+    appendToRunQueue(cap,tso);
+}
+
+void
+exportThread (Capability *cap, StgTSO *tso)
+{
+    ASSERT(tso->bound == NULL && !tsoLocked(tso));
+
+    tso->why_blocked = ThreadMigrating;
+    tso->flags |= TSO_EXPORTED;
+    traceEventThreadRunnable(cap, tso);
+    pushWSDeque(cap->exported_threads, tso);
+
+    wakeupIdleCapability(cap);
+}
+
+void
+reclaimExportedThreads (Capability *cap)
+{
+    StgTSO *tso;
+
+    // from the top, so that they go on the run queue in the order they
+    // were forked in
+    while ((tso = stealWSDeque(cap->exported_threads)) != NULL) {
+        takeExportedThread(cap, tso);
+    }
+}
+
+rtsBool
+findThread (Capability *cap)
+{
+    Capability *robbed;
+    StgTSO *tso;
+    nat i, start, pass;
+
+    if (n_capabilities == 1 || !RtsFlags.ParFlags.migrate) {
+        return rtsFalse;
+    }
+
+    // same order of victims as findSpark()
+    start = stealStart(cap);
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < n_capabilities; i++) {
+            robbed = &capabilities[(start + i) % n_capabilities];
+            if (cap == robbed ||
+                (robbed->steal_domain == cap->steal_domain) != (pass == 0) ||
+                looksEmptyWSDeque(robbed->exported_threads)) {
+                continue;
+            }
+
+            tso = stealWSDeque(robbed->exported_threads);
+            if (tso != NULL) {
+                debugTrace(DEBUG_sched, "cap %d: stole thread %lu from cap %d",
+                           cap->no, (unsigned long)tso->id, robbed->no);
+                takeExportedThread(cap, tso);
+                return rtsTrue;
+            }
+        }
+    }
+    return rtsFalse;
+}
+
+rtsBool
+wakeupIdleCapability (Capability *cap)
+{
+    Capability *cap0;
+    Task *task = cap->running_task;
+    nat i;
+
+    for (i = 0; i < n_capabilities; i++) {
+        cap0 = &capabilities[i];
+        if (cap0 != cap && cap0->running_task == NULL &&
+            tryGrabCapability(cap0, task)) {
+            releaseAndWakeupCapability(cap0);
+            task->cap = cap;
+            return rtsTrue;
+        }
+    }
+    return rtsFalse;
+}
 #endif
 
 /* -----------------------------------------------------------------------------
@@ -242,10 +414,15 @@ initCapability( Capability *cap, nat i )
     cap->sparks             = allocSparkPool();
     cap->spark_stats.created    = 0;
     cap->spark_stats.dud        = 0;
-    cap->spark_stats.overflowed = 0;
     cap->spark_stats.converted  = 0;
     cap->spark_stats.gcd        = 0;
     cap->spark_stats.fizzled    = 0;
+    // With +RTS -qa the capability's workers run on CPU i (see
+    // workerStart), so we know which package it is on
+    cap->steal_domain = RtsFlags.ParFlags.setAffinity
+        ? getProcessorPackage(i % getNumberOfProcessors()) : 0;
+    cap->steal_rand   = i * 2654435761U + 1;
+    cap->exported_threads = newWSDeque(64);
 #endif
 
     cap->f.stgEagerBlackholeInfo = (W_)&__stg_EAGER_BLACKHOLE_info;
@@ -269,6 +446,9 @@ initCapability( Capability *cap, nat i )
     cap->free_trec_headers = NO_TREC;
     cap->transaction_tokens = 0;
     cap->context_switch = 0;
+    cap->sample_stack = 0;
+    cap->sample_info = 0;
+    cap->info_samples = NULL;
     cap->pinned_object_block = NULL;
 
 #ifdef PROFILING
@@ -492,6 +672,7 @@ releaseCapability_ (Capability* cap,
     // anything else to do, give the Capability to a worker thread.
     if (always_wakeup || 
         !emptyRunQueue(cap) || !emptyInbox(cap) ||
+        !looksEmptyWSDeque(cap->exported_threads) ||
         !emptySparkPoolCap(cap) || globalWorkToDo()) {
 	if (cap->spare_workers) {
 	    giveCapabilityToTask(cap,cap->spare_workers);
@@ -954,6 +1135,7 @@ freeCapability (Capability *cap)
     stgFree(cap->saved_mut_lists);
 #if defined(THREADED_RTS)
     freeSparkPool(cap->sparks);
+    freeWSDeque(cap->exported_threads);
 #endif
 }
 
@@ -991,6 +1173,8 @@ markCapability (evac_fn evac, void *user, Capability *cap,
     evac(user, (StgClosure **)(void *)&cap->run_queue_tl);
 #if defined(THREADED_RTS)
     evac(user, (StgClosure **)(void *)&cap->inbox);
+    // scheduleDoGC() has put them on the run queues
+    ASSERT(looksEmptyWSDeque(cap->exported_threads));
 #endif
     for (incall = cap->suspended_ccalls; incall != NULL;
          incall=incall->next) {
@@ -1019,14 +1203,13 @@ markCapabilities (evac_fn evac, void *user)
 #if defined(THREADED_RTS)
 rtsBool checkSparkCountInvariant (void)
 {
-    SparkCounters sparks = { 0, 0, 0, 0, 0, 0 };
+    SparkCounters sparks = { 0, 0, 0, 0, 0 };
     StgWord64 remaining = 0;
     nat i;
 
     for (i = 0; i < n_capabilities; i++) {
         sparks.created   += capabilities[i].spark_stats.created;
         sparks.dud       += capabilities[i].spark_stats.dud;
-        sparks.overflowed+= capabilities[i].spark_stats.overflowed;
         sparks.converted += capabilities[i].spark_stats.converted;
         sparks.gcd       += capabilities[i].spark_stats.gcd;
         sparks.fizzled   += capabilities[i].spark_stats.fizzled;
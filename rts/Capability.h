@@ -86,6 +86,16 @@ struct Capability_ {
     // reset after we have executed the context switch.
     int interrupt;
 
+    // Set by the timer to ask for a sample of the running thread's
+    // stack when it next returns to the scheduler (+RTS
+    // --eventlog-stack-sample).
+    int sample_stack;
+
+    // Likewise for a sample of what the thread is evaluating (+RTS
+    // --info-table-samples), counted in info_samples (InfoTableProf.c)
+    int sample_info;
+    struct InfoSamples_ *info_samples;
+
 #if defined(THREADED_RTS)
     // Worker Tasks waiting in the wings.  Singly-linked.
     Task *spare_workers;
@@ -109,6 +119,16 @@ struct Capability_ {
 
     // Stats on spark creation/conversion
     SparkCounters spark_stats;
+
+    // For picking whom to steal sparks from (see findSpark): the
+    // package this capability runs on, when we know it, and the
+    // state of a cheap random number generator
+    nat steal_domain;
+    StgWord32 steal_rand;
+
+    // Freshly forked threads that idle Capabilities may steal before
+    // we get round to running them (see exportThread())
+    WSDeque *exported_threads;
 #endif
 
     // Per-capability STM-related data
@@ -271,6 +291,26 @@ StgClosure *findSpark (Capability *cap);
 //
 rtsBool anySparks (void);
 
+// Make a new thread stealable by other Capabilities instead of
+// putting it on our run queue, and wake up a free Capability to take
+// it.
+//
+void exportThread (Capability *cap, StgTSO *tso);
+
+// Put the threads we exported that nobody stole on our run queue
+//
+void reclaimExportedThreads (Capability *cap);
+
+// Try to steal a thread that another Capability exported, and put it
+// on our run queue
+//
+rtsBool findThread (Capability *cap);
+
+// Wake up a free Capability, if there is one, so that it can look
+// for work to steal.  Returns rtsFalse if all of them are busy.
+//
+rtsBool wakeupIdleCapability (Capability *cap);
+
 INLINE_HEADER rtsBool emptySparkPoolCap (Capability *cap);
 INLINE_HEADER nat     sparkPoolSizeCap  (Capability *cap);
 INLINE_HEADER void    discardSparksCap  (Capability *cap);
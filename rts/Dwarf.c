@@ -17,10 +17,12 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <string.h>
+#include <stdlib.h>
 
 
 // As far as I know, there are two ways for getting at the program's
@@ -46,17 +48,65 @@
 // Global compilation unit list
 DwarfUnit *dwarf_units = 0;
 
+// Units by name
+static HashTable *dwarf_unit_table = 0;
+
+// Address index, see dwarf_build_index. The start addresses are kept
+// apart from the rest so the binary search only touches the keys.
+static void **dwarf_index_low = 0;
+static void **dwarf_index_high = 0;
+static DwarfProc **dwarf_index_proc = 0;
+static nat dwarf_index_size = 0;
+
+// Samples that didn't fall into any procedure we know of
+static StgWord dwarf_unknown_samples = 0;
+
+// While the debug data gets loaded (see dwarf_init_tracing), samples
+// to be counted are kept here, up to a limit.
+static volatile StgBool dwarf_loading = 0;
+static void **dwarf_pending = 0;
+static nat dwarf_n_pending = 0;
+static nat dwarf_max_pending = 0;
+
+#define DWARF_MAX_PENDING_SAMPLES (1024 * 1024)
+
+#ifdef THREADED_RTS
+// Protects the above, and tells when the loader thread is done
+static Mutex dwarf_mutex;
+static Condition dwarf_loaded;
+static StgBool dwarf_loader_running = 0;
+static StgBool dwarf_loader_lost = 0; // forked while loading
+#endif
+
 // Debugging data
 size_t dwarf_ghc_debug_data_size = 0;
 void *dwarf_ghc_debug_data = 0;
 
 #define GHC_DEBUG_DATA_SECTION ".debug_ghc"
 
+// Longest build id we look for (they are 20 bytes with SHA-1)
+#define DWARF_MAX_BUILD_ID 64
+
+// Cache of the data loaded from each file (+RTS --eventlog-dwarf-cache),
+// see dwarf_cache_save for the format. While a file gets loaded, the
+// procedures it adds are recorded here, so they can be written out.
+typedef struct {
+	DwarfUnit *unit;
+	DwarfProc *proc;
+} DwarfCacheEntry;
+
+static StgBool dwarf_cache_recording = 0;
+static DwarfCacheEntry *dwarf_cache_entries = 0;
+static nat dwarf_cache_n_entries = 0;
+static nat dwarf_cache_max_entries = 0;
+
 static void *dwarf_get_code_offset(Elf *elf, void *seg_start);
 static void dwarf_load_ghc_debug_data(Elf *elf);
+static void dwarf_add_ghc_debug_data(void *data, size_t size);
 static void dwarf_load_symbols(char *file, Elf *elf, void *seg_start);
 
 static void dwarf_load_file(char *module_path, void *seg_start);
+static StgBool dwarf_load_units(char *module_path, Elf *elf, void *code_offset);
 static void dwarf_load_dies(DwarfUnit *unit, Dwarf_Debug dbg, Dwarf_Die die, void *seg_start);
 static void dwarf_load_die(DwarfUnit *unit, Dwarf_Debug dbg, Dwarf_Die die, void *seg_start);
 
@@ -64,9 +114,19 @@ static DwarfUnit *dwarf_new_unit(char *name, char *comp_dir);
 static DwarfProc *dwarf_new_proc(DwarfUnit *unit, char *name, void *low_pc, void *high_pc,
                                  DwarfSource source, DwarfProc *after);
 
+static void dwarf_free_index(void);
+
+static char *dwarf_cache_file_name(Elf *elf, char *build_id, size_t *build_id_size);
+static StgBool dwarf_cache_load(char *cache_file, char *build_id, size_t build_id_size,
+                                char *module_path, void *seg_start);
+static void dwarf_cache_save(char *cache_file, char *build_id, size_t build_id_size,
+                             char *module_path, void *seg_start,
+                             size_t ghc_data_start);
+
 #ifdef TRACING
 static void dwarf_trace_all_unaccounted(void);
 static void dwarf_trace_unaccounted(DwarfUnit *unit, StgBool put_module);
+static StgBool dwarf_wait_loader(void);
 #endif // TRACING
 
 #ifndef USE_DL_ITERATE_PHDR
@@ -206,6 +266,25 @@ void dwarf_load_file(char *module_path, void *seg_start)
 		return;
 	}
 
+	// Have we seen this file before? Files are recognised by their
+	// build id, so files without one don't get cached.
+	char build_id[DWARF_MAX_BUILD_ID];
+	size_t build_id_size = 0;
+	char *cache_file = 0;
+	if (RtsFlags.TraceFlags.dwarfCache) {
+		cache_file = dwarf_cache_file_name(elf, build_id, &build_id_size);
+		if (cache_file &&
+		    dwarf_cache_load(cache_file, build_id, build_id_size,
+		                     module_path, seg_start)) {
+			stgFree(cache_file);
+			elf_end(elf);
+			close(fd);
+			return;
+		}
+	}
+	size_t ghc_data_start = dwarf_ghc_debug_data_size;
+	dwarf_cache_recording = cache_file != 0;
+
 	// Load debug data
 	dwarf_load_ghc_debug_data(elf);
 
@@ -215,12 +294,31 @@ void dwarf_load_file(char *module_path, void *seg_start)
 	// Find symbol address offset
 	void *code_offset = dwarf_get_code_offset(elf, seg_start);
 
+	// Load procedures from the DWARF data, and remember them for next
+	// time if we got all of them
+	if (dwarf_load_units(module_path, elf, code_offset) && cache_file)
+		dwarf_cache_save(cache_file, build_id, build_id_size,
+		                 module_path, seg_start, ghc_data_start);
+
+	dwarf_cache_recording = 0;
+	dwarf_cache_n_entries = 0;
+	if (cache_file)
+		stgFree(cache_file);
+
+	elf_end(elf);
+	close(fd);
+}
+
+StgBool dwarf_load_units(char *module_path, Elf *elf, void *code_offset)
+{
+
 	// Open using libdwarf
 	Dwarf_Debug dbg; Dwarf_Error err;
-	if (dwarf_elf_init(elf, DW_DLC_READ, 0, 0, &dbg, &err) != DW_DLV_OK) {
+	int res = dwarf_elf_init(elf, DW_DLC_READ, 0, 0, &dbg, &err);
+	if (res != DW_DLV_OK) {
 		sysErrorBelch("Could not read debug data from %s!", module_path);
-		close(fd);
-		return;
+		// Nothing to read is as complete as it gets
+		return res == DW_DLV_NO_ENTRY;
 	}
 
 	// Read compilation units
@@ -242,14 +340,14 @@ void dwarf_load_file(char *module_path, void *seg_start)
 			break;
 		if (res != DW_DLV_OK) {
 			errorBelch("Could not read unit debug data from %s!", module_path);
-			return;
+			return 0;
 		}
 
 		// Get root die
 		Dwarf_Die cu_die = 0;
 		if (dwarf_siblingof(dbg, 0, &cu_die, &error) != DW_DLV_OK) {
 			errorBelch("Could not a read root die from %s!", module_path);
-			return;
+			return 0;
 		}
 
 		// Check that it is, in fact, a compilation unit die
@@ -283,9 +381,7 @@ void dwarf_load_file(char *module_path, void *seg_start)
 	// Done with DWARF
 	Dwarf_Error error;
 	dwarf_finish(dbg, &error);
-
-	elf_end(elf);
-	close(fd);
+	return 1;
 }
 
 void *dwarf_get_code_offset(Elf *elf, void *seg_start)
@@ -346,15 +442,7 @@ void dwarf_load_ghc_debug_data(Elf *elf)
 		while ((data = elf_getdata(scn, data))) {
 			if (!data->d_buf)
 				continue;
-			// Enlarge buffer, append data block
-			dwarf_ghc_debug_data =
-			    stgReallocBytes(dwarf_ghc_debug_data,
-			                    dwarf_ghc_debug_data_size + data->d_size,
-			                    "dwarf_load_ghc_debug_data");
-			memcpy(((char *)dwarf_ghc_debug_data) + dwarf_ghc_debug_data_size,
-			       data->d_buf,
-			       data->d_size);
-			dwarf_ghc_debug_data_size += data->d_size;
+			dwarf_add_ghc_debug_data(data->d_buf, data->d_size);
 		}
 
 		return;
@@ -362,6 +450,18 @@ void dwarf_load_ghc_debug_data(Elf *elf)
 
 }
 
+void dwarf_add_ghc_debug_data(void *data, size_t size)
+{
+	// Enlarge buffer, append data block
+	dwarf_ghc_debug_data =
+	    stgReallocBytes(dwarf_ghc_debug_data,
+	                    dwarf_ghc_debug_data_size + size,
+	                    "dwarf_add_ghc_debug_data");
+	memcpy(((char *)dwarf_ghc_debug_data) + dwarf_ghc_debug_data_size,
+	       data, size);
+	dwarf_ghc_debug_data_size += size;
+}
+
 // Use "FILE" type annotations in symbol table to find out which files
 // the symbols originally came from. Sadly, this is not very useful
 // until
@@ -572,11 +672,9 @@ void dwarf_load_die(DwarfUnit *unit, Dwarf_Debug dbg, Dwarf_Die die, void *code_
 
 DwarfUnit *dwarf_get_unit(char *name)
 {
-	DwarfUnit *unit;
-	for (unit = dwarf_units; unit; unit = unit->next)
-		if (!strcmp(name, unit->name))
-			return unit;
-	return 0;
+	if (!dwarf_unit_table)
+		return 0;
+	return (DwarfUnit *)lookupStrHashTable(dwarf_unit_table, name);
 }
 
 DwarfUnit *dwarf_new_unit(char *name, char *comp_dir)
@@ -585,18 +683,19 @@ DwarfUnit *dwarf_new_unit(char *name, char *comp_dir)
 	unit->name = strdup(name);
 	unit->comp_dir = strdup(comp_dir);
 	unit->procs = 0;
+	unit->proc_table = allocStrHashTable();
 	unit->next = dwarf_units;
 	dwarf_units = unit;
+
+	if (!dwarf_unit_table)
+		dwarf_unit_table = allocStrHashTable();
+	insertStrHashTable(dwarf_unit_table, unit->name, unit);
 	return unit;
 }
 
 DwarfProc *dwarf_get_proc(DwarfUnit *unit, char *name)
 {
-	DwarfProc *proc;
-	for (proc = unit->procs; proc; proc = proc->next)
-		if (!strcmp(name, proc->name))
-			return proc;
-	return 0;
+	return (DwarfProc *)lookupStrHashTable(unit->proc_table, name);
 }
 
 DwarfProc *dwarf_new_proc(DwarfUnit *unit, char *name,
@@ -611,18 +710,49 @@ DwarfProc *dwarf_new_proc(DwarfUnit *unit, char *name,
 	proc->high_pc = high_pc;
 	proc->source = source;
 	proc->copied = 0;
+	proc->samples = 0;
 
 	proc->next = (after ? after->next : unit->procs);
 	*(after ? &after->next : &unit->procs) = proc;
 
+	// The table points to the first proc of each name in the list
+	if (!after) {
+		removeStrHashTable(unit->proc_table, name, NULL);
+		insertStrHashTable(unit->proc_table, proc->name, proc);
+	}
+
+	// Remember for the cache, see dwarf_load_file
+	if (dwarf_cache_recording) {
+		if (dwarf_cache_n_entries == dwarf_cache_max_entries) {
+			dwarf_cache_max_entries =
+				dwarf_cache_max_entries ? 2 * dwarf_cache_max_entries : 1024;
+			dwarf_cache_entries = (DwarfCacheEntry *)
+				stgReallocBytes(dwarf_cache_entries,
+				                dwarf_cache_max_entries * sizeof(DwarfCacheEntry),
+				                "dwarf_new_proc");
+		}
+		dwarf_cache_entries[dwarf_cache_n_entries].unit = unit;
+		dwarf_cache_entries[dwarf_cache_n_entries].proc = proc;
+		dwarf_cache_n_entries++;
+	}
+
 	return proc;
 }
 
 void dwarf_free()
 {
+	dwarf_free_index();
+	dwarf_unknown_samples = 0;
+
+	if (dwarf_unit_table) {
+		freeHashTable(dwarf_unit_table, NULL);
+		dwarf_unit_table = 0;
+	}
+
 	DwarfUnit *unit;
 	while ((unit = dwarf_units)) {
 		dwarf_units = unit->next;
+		freeHashTable(unit->proc_table, NULL);
 
 		DwarfProc *proc;
 		while ((proc = unit->procs)) {
@@ -637,9 +767,671 @@ void dwarf_free()
 	}
 	free(dwarf_ghc_debug_data);
 	dwarf_ghc_debug_data = 0;
+	dwarf_ghc_debug_data_size = 0;
+
+	stgFree(dwarf_cache_entries);
+	dwarf_cache_entries = 0;
+	dwarf_cache_n_entries = 0;
+	dwarf_cache_max_entries = 0;
 }
 
+// Order procedures by start address, longest first, so that a
+// procedure comes before the ones nested in it. For identical ranges
+// the DWARF entry goes last, so it wins over the symbol table one.
+static int dwarf_compare_procs(const void *a, const void *b)
+{
+	const DwarfProc *p = *(const DwarfProc **)a;
+	const DwarfProc *q = *(const DwarfProc **)b;
+	if (p->low_pc != q->low_pc)
+		return p->low_pc < q->low_pc ? -1 : 1;
+	if (p->high_pc != q->high_pc)
+		return p->high_pc > q->high_pc ? -1 : 1;
+	if (p->source != q->source)
+		return p->source == DwarfSourceSymtab ? -1 : 1;
+	return 0;
+}
+
+static void dwarf_add_range(void *low_pc, void *high_pc, DwarfProc *proc)
+{
+	if (low_pc >= high_pc)
+		return;
+
+	// Extend the previous range if it is the same procedure
+	nat last = dwarf_index_size - 1;
+	if (dwarf_index_size > 0 &&
+	    dwarf_index_proc[last] == proc &&
+	    dwarf_index_high[last] == low_pc) {
+		dwarf_index_high[last] = high_pc;
+		return;
+	}
+
+	dwarf_index_low[dwarf_index_size] = low_pc;
+	dwarf_index_high[dwarf_index_size] = high_pc;
+	dwarf_index_proc[dwarf_index_size] = proc;
+	dwarf_index_size++;
+}
+
+// Builds a sorted array of non-overlapping address ranges, each
+// belonging to the innermost procedure that covers it. Inlined
+// subroutines therefore split the range of the procedure they were
+// inlined into.
+
+void dwarf_build_index()
+{
+	DwarfUnit *unit;
+	DwarfProc *proc, *top;
+	nat n = 0, i, sp = 0;
+
+	dwarf_free_index();
+
+	for (unit = dwarf_units; unit; unit = unit->next)
+		for (proc = unit->procs; proc; proc = proc->next)
+			if (proc->low_pc < proc->high_pc)
+				n++;
+	if (!n)
+		return;
+
+	DwarfProc **procs = (DwarfProc **)
+		stgMallocBytes(n * sizeof(DwarfProc *), "dwarf_build_index");
+	DwarfProc **stack = (DwarfProc **)
+		stgMallocBytes(n * sizeof(DwarfProc *), "dwarf_build_index");
+	n = 0;
+	for (unit = dwarf_units; unit; unit = unit->next)
+		for (proc = unit->procs; proc; proc = proc->next)
+			if (proc->low_pc < proc->high_pc)
+				procs[n++] = proc;
+	qsort(procs, n, sizeof(DwarfProc *), dwarf_compare_procs);
+
+	// Every procedure adds at most two ranges: one for the part of
+	// its parent before it, one for itself.
+	dwarf_index_low = (void **)
+		stgMallocBytes(2 * n * sizeof(void *), "dwarf_build_index");
+	dwarf_index_high = (void **)
+		stgMallocBytes(2 * n * sizeof(void *), "dwarf_build_index");
+	dwarf_index_proc = (DwarfProc **)
+		stgMallocBytes(2 * n * sizeof(DwarfProc *), "dwarf_build_index");
+
+	// Sweep over the procedures, keeping the ones we are inside of on
+	// a stack
+	void *pos = 0;
+	for (i = 0; i < n; i++) {
+		proc = procs[i];
+
+		// Close procedures ending before this one starts
+		while (sp > 0 && stack[sp-1]->high_pc <= proc->low_pc) {
+			top = stack[--sp];
+			if (pos < top->high_pc) {
+				dwarf_add_range(pos, top->high_pc, top);
+				pos = top->high_pc;
+			}
+		}
+
+		// The enclosing procedure covers everything up to here
+		if (sp > 0)
+			dwarf_add_range(pos, proc->low_pc, stack[sp-1]);
+		pos = proc->low_pc;
+		stack[sp++] = proc;
+	}
+	while (sp > 0) {
+		top = stack[--sp];
+		if (pos < top->high_pc) {
+			dwarf_add_range(pos, top->high_pc, top);
+			pos = top->high_pc;
+		}
+	}
+
+	stgFree(stack);
+	stgFree(procs);
+}
+
+void dwarf_free_index()
+{
+	dwarf_index_size = 0;
+	stgFree(dwarf_index_low);
+	stgFree(dwarf_index_high);
+	stgFree(dwarf_index_proc);
+	dwarf_index_low = 0;
+	dwarf_index_high = 0;
+	dwarf_index_proc = 0;
+}
+
+DwarfProc *dwarf_lookup_ip(void *ip)
+{
+	// Find the last range starting at or before ip
+	nat lo = 0, hi = dwarf_index_size, mid;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (dwarf_index_low[mid] <= ip)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0 || ip >= dwarf_index_high[lo-1])
+		return 0;
+	return dwarf_index_proc[lo-1];
+}
+
+// Keeps samples for when the index is there. Returns false if there is
+// no room left for them.
+static StgBool dwarf_queue_samples(StgWord32 cnt, void **ips)
+{
+	if (dwarf_n_pending + cnt > DWARF_MAX_PENDING_SAMPLES)
+		return 0;
+	if (dwarf_n_pending + cnt > dwarf_max_pending) {
+		dwarf_max_pending = 2 * (dwarf_n_pending + cnt);
+		if (dwarf_max_pending > DWARF_MAX_PENDING_SAMPLES)
+			dwarf_max_pending = DWARF_MAX_PENDING_SAMPLES;
+		dwarf_pending = stgReallocBytes(dwarf_pending,
+		                                dwarf_max_pending * sizeof(void *),
+		                                "dwarf_queue_samples");
+	}
+	memcpy(dwarf_pending + dwarf_n_pending, ips, cnt * sizeof(void *));
+	dwarf_n_pending += cnt;
+	return 1;
+}
+
+// Attributes the samples to procedures, with dwarf_mutex held
+static void dwarf_count_samples_(StgWord32 cnt, void **ips)
+{
+	StgWord32 i;
+	DwarfProc *proc;
+
+	for (i = 0; i < cnt; i++) {
+		proc = dwarf_lookup_ip(ips[i]);
+		if (proc)
+			proc->samples++;
+		else
+			dwarf_unknown_samples++;
+	}
+}
+
+StgBool dwarf_count_samples(StgWord32 cnt, void **ips)
+{
+	StgBool counted = 1;
+
+	// Nothing to count them in? Spare us the lock.
+	if (!dwarf_loading && !dwarf_index_size)
+		return 0;
+
+	// Samples get posted from all tasks, and the index gets rebuilt
+	// when the linker loads code, see dwarf_update_index
+#ifdef THREADED_RTS
+	ACQUIRE_LOCK(&dwarf_mutex);
+#endif
+
+	// Still loading? If there's no more room to keep the samples,
+	// they get posted as they are.
+	if (dwarf_loading)
+		counted = dwarf_queue_samples(cnt, ips);
+	else if (dwarf_index_size)
+		dwarf_count_samples_(cnt, ips);
+	else
+		counted = 0;
+
+#ifdef THREADED_RTS
+	RELEASE_LOCK(&dwarf_mutex);
+#endif
+	return counted;
+}
+
+// Set if dwarf_acquire_index had to build the index itself
+static StgBool dwarf_index_acquired = 0;
+
+StgBool dwarf_acquire_index()
+{
 #ifdef TRACING
+	// Tracing might be loading the data already
+	if (RtsFlags.TraceFlags.tracing && !dwarf_wait_loader())
+		return 0;
+#endif
+	if (dwarf_index_size)
+		return 1;
+
+	if (!dwarf_units)
+		dwarf_load();
+	dwarf_build_index();
+	dwarf_index_acquired = 1;
+	return dwarf_index_size > 0;
+}
+
+void dwarf_release_index()
+{
+	if (dwarf_index_acquired) {
+		dwarf_free();
+		dwarf_index_acquired = 0;
+	}
+}
+
+// The debug data cache. For every file with a build id we write what
+// we loaded from it to <dir>/<build id>.dwarf-cache, in the layout
+//
+//   header, build id, module path, pad to 8 bytes,
+//   n_procs * DwarfCacheProc, ghc debug data, strings
+//
+// Addresses are kept relative to the start of the file's mapping, as
+// shared libraries (and PIEs) get loaded somewhere else every time.
+// The file is written on the machine that reads it, so it is in the
+// native byte order. Loading maps the file and adds the procedures in
+// the order they were recorded, which gives the same lists as parsing.
+
+#define DWARF_CACHE_MAGIC 0x4748434457434831ULL // "GHCDWCH1"
+
+typedef struct {
+	StgWord64 magic;
+	StgWord32 word_size;     // sizeof(void *) of the writer
+	StgWord32 build_id_size;
+	StgWord32 path_size;     // including the terminating '\0'
+	StgWord32 n_procs;
+	StgWord64 ghc_data_size;
+	StgWord64 strings_size;
+} DwarfCacheHeader;
+
+typedef struct {
+	StgWord64 low_pc;        // relative to the start of the mapping
+	StgWord64 high_pc;
+	StgWord32 unit_name;     // offsets into the strings
+	StgWord32 comp_dir;
+	StgWord32 name;
+	StgWord32 source;
+} DwarfCacheProc;
+
+#define DWARF_CACHE_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+// Gets the name of the cache file for a file from its build id, or
+// NULL if it has none
+char *dwarf_cache_file_name(Elf *elf, char *build_id, size_t *build_id_size)
+{
+	Elf_Scn *scn = 0;
+	GElf_Shdr hdr;
+	Elf_Data *data;
+	GElf_Nhdr nhdr;
+	size_t offset, next, name_offset, desc_offset;
+
+	*build_id_size = 0;
+	while (!*build_id_size && (scn = elf_nextscn(elf, scn))) {
+		if (!gelf_getshdr(scn, &hdr) || hdr.sh_type != SHT_NOTE)
+			continue;
+		if (!(data = elf_getdata(scn, 0)))
+			continue;
+		for (offset = 0;
+		     (next = gelf_getnote(data, offset, &nhdr, &name_offset, &desc_offset)) > 0;
+		     offset = next) {
+			if (nhdr.n_type == NT_GNU_BUILD_ID &&
+			    nhdr.n_namesz == 4 &&
+			    !memcmp((char *)data->d_buf + name_offset, "GNU", 4) &&
+			    nhdr.n_descsz > 0 && nhdr.n_descsz <= DWARF_MAX_BUILD_ID) {
+				memcpy(build_id, (char *)data->d_buf + desc_offset, nhdr.n_descsz);
+				*build_id_size = nhdr.n_descsz;
+				break;
+			}
+		}
+	}
+	if (!*build_id_size)
+		return 0;
+
+	char *dir = RtsFlags.TraceFlags.dwarfCache;
+	char *file = stgMallocBytes(strlen(dir) + 2 * *build_id_size + 16,
+	                            "dwarf_cache_file_name");
+	char *p = file + sprintf(file, "%s/", dir);
+	size_t i;
+	for (i = 0; i < *build_id_size; i++)
+		p += sprintf(p, "%02x", (unsigned char)build_id[i]);
+	strcpy(p, ".dwarf-cache");
+	return file;
+}
+
+StgBool dwarf_cache_load(char *cache_file, char *build_id, size_t build_id_size,
+                         char *module_path, void *seg_start)
+{
+	int fd = open(cache_file, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	struct stat st;
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(DwarfCacheHeader)) {
+		close(fd);
+		return 0;
+	}
+	size_t size = st.st_size;
+	char *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return 0;
+
+	// Check that the file is complete, and for this file
+	DwarfCacheHeader *hdr = (DwarfCacheHeader *)base;
+	size_t path_size = strlen(module_path) + 1;
+	size_t procs_offset = DWARF_CACHE_ALIGN(sizeof(DwarfCacheHeader) +
+	                                        build_id_size + path_size);
+	size_t ghc_data_offset = procs_offset + hdr->n_procs * sizeof(DwarfCacheProc);
+	size_t strings_offset = ghc_data_offset + hdr->ghc_data_size;
+	if (hdr->magic != DWARF_CACHE_MAGIC ||
+	    hdr->word_size != sizeof(void *) ||
+	    hdr->build_id_size != build_id_size ||
+	    hdr->path_size != path_size ||
+	    strings_offset + hdr->strings_size != size ||
+	    hdr->strings_size == 0 ||
+	    base[size - 1] != '\0' ||
+	    memcmp(base + sizeof(DwarfCacheHeader), build_id, build_id_size) ||
+	    memcmp(base + sizeof(DwarfCacheHeader) + build_id_size, module_path, path_size)) {
+		munmap(base, size);
+		return 0;
+	}
+
+	// Add the procedures, just like loading them did
+	DwarfCacheProc *procs = (DwarfCacheProc *)(base + procs_offset);
+	char *strings = base + strings_offset;
+	nat i;
+	for (i = 0; i < hdr->n_procs; i++) {
+		DwarfCacheProc *p = &procs[i];
+		if (p->unit_name >= hdr->strings_size ||
+		    p->comp_dir >= hdr->strings_size ||
+		    p->name >= hdr->strings_size)
+			continue;
+		char *name = strings + p->name;
+		DwarfUnit *unit = dwarf_get_unit(strings + p->unit_name);
+		if (!unit) unit = dwarf_new_unit(strings + p->unit_name, strings + p->comp_dir);
+		dwarf_new_proc(unit, name,
+		               (void *)((StgWord)seg_start + (StgWord)p->low_pc),
+		               (void *)((StgWord)seg_start + (StgWord)p->high_pc),
+		               (DwarfSource)p->source,
+		               p->source == DwarfSourceDwarf ? dwarf_get_proc(unit, name) : 0);
+	}
+	if (hdr->ghc_data_size)
+		dwarf_add_ghc_debug_data(base + ghc_data_offset, hdr->ghc_data_size);
+
+	munmap(base, size);
+	return 1;
+}
+
+// Appends a string to the strings of the cache, unless it is there
+// already (in table, if given, which str must outlive). Returns its
+// offset.
+static StgWord32 dwarf_cache_string(char **strings, size_t *size, size_t *max_size,
+                                    HashTable *table, char *str)
+{
+	if (table) {
+		StgWord off = (StgWord)lookupStrHashTable(table, str);
+		if (off)
+			return off - 1;
+	}
+	size_t len = strlen(str) + 1;
+	if (*size + len > *max_size) {
+		*max_size = 2 * (*size + len);
+		*strings = stgReallocBytes(*strings, *max_size, "dwarf_cache_string");
+	}
+	StgWord32 off = *size;
+	memcpy(*strings + off, str, len);
+	*size += len;
+	if (table)
+		insertStrHashTable(table, str, (void *)(StgWord)(off + 1));
+	return off;
+}
+
+void dwarf_cache_save(char *cache_file, char *build_id, size_t build_id_size,
+                      char *module_path, void *seg_start, size_t ghc_data_start)
+{
+	DwarfCacheHeader hdr;
+	size_t path_size = strlen(module_path) + 1;
+	size_t header_size = DWARF_CACHE_ALIGN(sizeof(DwarfCacheHeader) +
+	                                       build_id_size + path_size);
+	char *header = stgMallocBytes(header_size, "dwarf_cache_save");
+	DwarfCacheProc *procs = stgMallocBytes(
+		(dwarf_cache_n_entries ? dwarf_cache_n_entries : 1) * sizeof(DwarfCacheProc),
+		"dwarf_cache_save");
+	size_t strings_size = 0, strings_max = 4096;
+	char *strings = stgMallocBytes(strings_max, "dwarf_cache_save");
+	HashTable *units = allocStrHashTable();
+	nat i;
+
+	// The units are shared by many procedures, so only store them once
+	for (i = 0; i < dwarf_cache_n_entries; i++) {
+		DwarfCacheEntry *e = &dwarf_cache_entries[i];
+		procs[i].low_pc = (StgWord)e->proc->low_pc - (StgWord)seg_start;
+		procs[i].high_pc = (StgWord)e->proc->high_pc - (StgWord)seg_start;
+		procs[i].unit_name = dwarf_cache_string(&strings, &strings_size, &strings_max,
+		                                        units, e->unit->name);
+		procs[i].comp_dir = dwarf_cache_string(&strings, &strings_size, &strings_max,
+		                                       units, e->unit->comp_dir);
+		procs[i].name = dwarf_cache_string(&strings, &strings_size, &strings_max,
+		                                   0, e->proc->name);
+		procs[i].source = e->proc->source;
+	}
+	freeHashTable(units, NULL);
+	if (!strings_size)
+		strings[strings_size++] = '\0';
+
+	hdr.magic = DWARF_CACHE_MAGIC;
+	hdr.word_size = sizeof(void *);
+	hdr.build_id_size = build_id_size;
+	hdr.path_size = path_size;
+	hdr.n_procs = dwarf_cache_n_entries;
+	hdr.ghc_data_size = dwarf_ghc_debug_data_size - ghc_data_start;
+	hdr.strings_size = strings_size;
+	memset(header, 0, header_size);
+	memcpy(header, &hdr, sizeof(hdr));
+	memcpy(header + sizeof(hdr), build_id, build_id_size);
+	memcpy(header + sizeof(hdr) + build_id_size, module_path, path_size);
+
+	// Write to a temporary file and move it into place, so that
+	// programs starting at the same time never see half a cache
+	char *tmp_file = stgMallocBytes(strlen(cache_file) + 32, "dwarf_cache_save");
+	sprintf(tmp_file, "%s.%d", cache_file, (int)getpid());
+	FILE *f = fopen(tmp_file, "wb");
+	if (!f) {
+		sysErrorBelch("Could not write debug data cache %s", cache_file);
+	} else {
+		StgBool ok =
+			fwrite(header, 1, header_size, f) == header_size &&
+			fwrite(procs, sizeof(DwarfCacheProc), hdr.n_procs, f) == hdr.n_procs &&
+			fwrite((char *)dwarf_ghc_debug_data + ghc_data_start, 1,
+			       hdr.ghc_data_size, f) == hdr.ghc_data_size &&
+			fwrite(strings, 1, strings_size, f) == strings_size;
+		if (fclose(f) || !ok || rename(tmp_file, cache_file)) {
+			sysErrorBelch("Could not write debug data cache %s", cache_file);
+			unlink(tmp_file);
+		}
+	}
+
+	stgFree(tmp_file);
+	stgFree(strings);
+	stgFree(procs);
+	stgFree(header);
+}
+
+#ifdef TRACING
+
+// Loads the debug data and posts it to the event log. We only keep it
+// if IP samples are to be counted per procedure.
+static void OSThreadProcAttr dwarf_loader(void *unused STG_UNUSED)
+{
+	dwarf_load();
+	dwarf_trace_debug_data();
+
+	if (RtsFlags.TraceFlags.symbolize) {
+		dwarf_build_index();
+
+		// Count the samples that came in while we were at it
+#ifdef THREADED_RTS
+		ACQUIRE_LOCK(&dwarf_mutex);
+#endif
+		dwarf_loading = 0;
+		if (dwarf_index_size)
+			dwarf_count_samples_(dwarf_n_pending, dwarf_pending);
+		stgFree(dwarf_pending);
+		dwarf_pending = 0;
+		dwarf_n_pending = dwarf_max_pending = 0;
+#ifdef THREADED_RTS
+		RELEASE_LOCK(&dwarf_mutex);
+#endif
+	} else {
+		dwarf_free();
+	}
+
+#ifdef THREADED_RTS
+	ACQUIRE_LOCK(&dwarf_mutex);
+	dwarf_loader_running = 0;
+	broadcastCondition(&dwarf_loaded);
+	RELEASE_LOCK(&dwarf_mutex);
+#endif
+}
+
+// With +RTS --eventlog-dwarf-async, the loading happens on a thread of
+// its own, so the program doesn't have to wait for it.
+void dwarf_init_tracing()
+{
+	dwarf_loading = RtsFlags.TraceFlags.symbolize;
+
+#ifdef THREADED_RTS
+	initMutex(&dwarf_mutex);
+	initCondition(&dwarf_loaded);
+
+	if (RtsFlags.TraceFlags.dwarfAsync) {
+		OSThreadId tid;
+		dwarf_loader_running = 1;
+		if (createOSThread(&tid, dwarf_loader, NULL) == 0)
+			return;
+		sysErrorBelch("Could not start thread for loading debug data");
+		dwarf_loader_running = 0;
+	}
+#endif
+
+	dwarf_loader(NULL);
+}
+
+// Waits for the loader to finish. Returns false if it never will, as
+// we forked while it was running.
+static StgBool dwarf_wait_loader(void)
+{
+#ifdef THREADED_RTS
+	// The data is in whatever state the loader left it in
+	if (dwarf_loader_lost)
+		return 0;
+
+	ACQUIRE_LOCK(&dwarf_mutex);
+	while (dwarf_loader_running)
+		waitCondition(&dwarf_loaded, &dwarf_mutex);
+	RELEASE_LOCK(&dwarf_mutex);
+#endif
+	return 1;
+}
+
+// Posts the samples counted, and frees everything, once the loader is
+// done.
+void dwarf_exit_tracing()
+{
+	if (!dwarf_wait_loader())
+		return;
+
+	dwarf_trace_samples();
+	dwarf_free();
+}
+
+// In the child of a fork the loader thread is gone
+void dwarf_fork_child()
+{
+#ifdef THREADED_RTS
+	initMutex(&dwarf_mutex);
+	initCondition(&dwarf_loaded);
+	if (dwarf_loader_running) {
+		dwarf_loader_running = 0;
+		dwarf_loader_lost = 1;
+		dwarf_loading = 0;
+		dwarf_index_size = 0;
+	}
+#endif
+}
+
+// Code loaded by the RTS linker (see ocGetNames_ELF) gets a unit per
+// object, named like the symbol table units of the files we loaded at
+// startup. The units are posted once complete, the index is only
+// rebuilt once the linker is done with a batch of objects.
+
+static StgBool dwarf_index_stale = 0;
+
+DwarfUnit *dwarf_add_object(char *object_name)
+{
+	char unit_name[1024];
+	DwarfUnit *unit;
+
+	// Can't touch the units while the loader might
+	if (!dwarf_wait_loader())
+		return 0;
+
+	snprintf(unit_name, 1024, SYMTAB_UNIT_NAME, object_name);
+	unit = dwarf_get_unit(unit_name);
+	if (!unit) unit = dwarf_new_unit(unit_name, "");
+	return unit;
+}
+
+void dwarf_add_object_proc(DwarfUnit *unit, char *name, void *low_pc, void *high_pc)
+{
+	DwarfProc *proc = dwarf_get_proc(unit, name);
+	dwarf_new_proc(unit, name, low_pc, high_pc, DwarfSourceSymtab, proc);
+	dwarf_index_stale = 1;
+}
+
+void dwarf_trace_object(DwarfUnit *unit)
+{
+	dwarf_trace_unaccounted(unit, 1);
+}
+
+// The linker unloads an object: its code may be replaced by something
+// else at the same address, so the index mustn't point to its procs
+// anymore. Samples counted in them so far are lost.
+void dwarf_remove_object(char *object_name)
+{
+	char unit_name[1024];
+	DwarfUnit *unit, **prev;
+	DwarfProc *proc;
+
+	if (!dwarf_wait_loader())
+		return;
+
+	snprintf(unit_name, 1024, SYMTAB_UNIT_NAME, object_name);
+	unit = dwarf_get_unit(unit_name);
+	if (!unit)
+		return;
+
+#ifdef THREADED_RTS
+	ACQUIRE_LOCK(&dwarf_mutex);
+#endif
+	for (prev = &dwarf_units; *prev != unit; prev = &(*prev)->next)
+		;
+	*prev = unit->next;
+	removeStrHashTable(dwarf_unit_table, unit->name, NULL);
+	if (dwarf_index_size)
+		dwarf_build_index();
+#ifdef THREADED_RTS
+	RELEASE_LOCK(&dwarf_mutex);
+#endif
+
+	freeHashTable(unit->proc_table, NULL);
+	while ((proc = unit->procs)) {
+		unit->procs = proc->next;
+		free(proc->name);
+		free(proc);
+	}
+	free(unit->name);
+	free(unit->comp_dir);
+	free(unit);
+}
+
+void dwarf_update_index()
+{
+	if (!dwarf_index_stale)
+		return;
+	dwarf_index_stale = 0;
+	if (!RtsFlags.TraceFlags.symbolize)
+		return;
+
+#ifdef THREADED_RTS
+	ACQUIRE_LOCK(&dwarf_mutex);
+#endif
+	dwarf_build_index();
+#ifdef THREADED_RTS
+	RELEASE_LOCK(&dwarf_mutex);
+#endif
+}
 
 // Writes debug data to the event log, enriching it with DWARF
 // debugging information where possible
@@ -720,6 +1512,47 @@ void dwarf_trace_all_unaccounted()
 	}
 }
 
+// Posts the samples counted by dwarf_count_samples. Procedures are
+// identified by their start address, as given in the
+// EVENT_DEBUG_PTR_RANGE events, samples outside of any procedure are
+// posted for address 0.
+
+#define DWARF_SAMPLES_PER_EVENT 1024
+
+void dwarf_trace_samples()
+{
+	void *pcs[DWARF_SAMPLES_PER_EVENT];
+	StgWord64 samples[DWARF_SAMPLES_PER_EVENT];
+	nat n = 0;
+	DwarfUnit *unit;
+	DwarfProc *proc;
+
+	if (!dwarf_index_size)
+		return;
+
+	for (unit = dwarf_units; unit; unit = unit->next)
+		for (proc = unit->procs; proc; proc = proc->next) {
+			if (!proc->samples)
+				continue;
+			pcs[n] = proc->low_pc;
+			samples[n] = proc->samples;
+			proc->samples = 0;
+			if (++n == DWARF_SAMPLES_PER_EVENT) {
+				traceProcSamples(n, pcs, samples);
+				n = 0;
+			}
+		}
+
+	if (dwarf_unknown_samples) {
+		pcs[n] = 0;
+		samples[n] = dwarf_unknown_samples;
+		dwarf_unknown_samples = 0;
+		n++;
+	}
+	if (n)
+		traceProcSamples(n, pcs, samples);
+}
+
 void dwarf_trace_unaccounted(DwarfUnit *unit, StgBool put_module)
 {
 	DwarfProc *proc;
@@ -2,6 +2,8 @@
 #ifndef DWARF_H
 #define DWARF_H
 
+#include "Hash.h"
+
 #include "BeginPrivate.h"
 
 #ifdef USE_DWARF
@@ -14,6 +16,7 @@ struct DwarfUnit_ {
 	char *name;
 	char *comp_dir;
 	DwarfProc *procs;
+	HashTable *proc_table; // name -> first proc of that name
 	DwarfUnit *next;
 };
 
@@ -28,6 +31,7 @@ struct DwarfProc_ {
 	void *high_pc;
 	StgBool copied;
 	DwarfSource source;
+	StgWord samples; // instruction pointer samples, see dwarf_count_samples
 	struct DwarfProc_ *next;
 };
 
@@ -38,8 +42,40 @@ DwarfUnit *dwarf_get_unit(char *name);
 DwarfProc *dwarf_get_proc(DwarfUnit *unit, char *name);
 void dwarf_free(void);
 
+// Sorted address index of all procedures, built after dwarf_load
+void dwarf_build_index(void);
+DwarfProc *dwarf_lookup_ip(void *ip);
+
+// Attribute instruction pointer samples to procedures. Returns false
+// if there's no index to look them up in.
+StgBool dwarf_count_samples(StgWord32 cnt, void **ips);
+
+// For looking up addresses outside of tracing (see InfoTableProf.c):
+// makes sure there's an index, loading the debug data if nobody has.
+// Returns false if there is none. dwarf_release_index frees what
+// dwarf_acquire_index loaded.
+StgBool dwarf_acquire_index(void);
+void dwarf_release_index(void);
+
 #ifdef TRACING
 void dwarf_trace_debug_data(void);
+void dwarf_trace_samples(void);
+
+// Load the debug data and post it to the event log at startup, maybe
+// in the background, and post the samples counted at exit
+void dwarf_init_tracing(void);
+void dwarf_exit_tracing(void);
+void dwarf_fork_child(void);
+
+// Code loaded by the RTS linker: a unit per object, posted to the
+// event log by dwarf_trace_object. dwarf_update_index brings the index
+// up to date with all objects added since the last call,
+// dwarf_remove_object takes an unloaded object out of it right away.
+DwarfUnit *dwarf_add_object(char *object_name);
+void dwarf_add_object_proc(DwarfUnit *unit, char *name, void *low_pc, void *high_pc);
+void dwarf_trace_object(DwarfUnit *unit);
+void dwarf_remove_object(char *object_name);
+void dwarf_update_index(void);
 #endif // TRACING
 
 #endif // USE_DWARF
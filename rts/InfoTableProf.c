@@ -0,0 +1,241 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2012
+ *
+ * Time profiling by info table, without -prof
+ *
+ * Cost-centre profiling needs the whole program built with -prof. This
+ * is a cheaper alternative that works on any build: on every tick
+ * (+RTS --info-table-samples) each capability notes what its thread is
+ * evaluating the next time the thread returns to the scheduler, and
+ * counts how often it saw each info table.
+ *
+ * ---------------------------------------------------------------------------*/
+
+#include "PosixSource.h"
+#include "Rts.h"
+
+#include "InfoTableProf.h"
+#include "Capability.h"
+#include "RtsUtils.h"
+#include "Hash.h"
+#include "Trace.h"
+
+#ifdef USE_DWARF
+#include "Dwarf.h"
+#endif
+
+#include <string.h>
+
+// The info tables a capability saw, in the order it first saw them, as
+// (info, count) pairs like EVENT_INFO_TABLE_SAMPLES has them, and a
+// hash from info pointer to index + 1 into them
+struct InfoSamples_ {
+    HashTable *index;
+    StgWord64 *samples;
+    nat n_samples;
+    nat max_samples;
+};
+
+typedef struct InfoSamples_ InfoSamples;
+
+static InfoSamples *
+newInfoSamples (void)
+{
+    InfoSamples *s;
+
+    s = stgMallocBytes(sizeof(InfoSamples), "newInfoSamples");
+    s->index = allocHashTable();
+    s->samples = NULL;
+    s->n_samples = 0;
+    s->max_samples = 0;
+    return s;
+}
+
+static void
+freeInfoSamples (InfoSamples *s)
+{
+    freeHashTable(s->index, NULL);
+    stgFree(s->samples);
+    stgFree(s);
+}
+
+static void
+addInfoSamples (InfoSamples *s, StgWord64 info, StgWord64 count)
+{
+    StgWord i;
+
+    i = (StgWord)lookupHashTable(s->index, (StgWord)info);
+    if (i == 0) {
+        if (s->n_samples == s->max_samples) {
+            s->max_samples = s->max_samples ? 2 * s->max_samples : 256;
+            s->samples = stgReallocBytes(s->samples,
+                                         2 * s->max_samples * sizeof(StgWord64),
+                                         "addInfoSamples");
+        }
+        s->samples[2 * s->n_samples] = info;
+        s->samples[2 * s->n_samples + 1] = 0;
+        i = ++s->n_samples;
+        insertHashTable(s->index, (StgWord)info, (void *)i);
+    }
+    s->samples[2 * (i-1) + 1] += count;
+}
+
+/* -----------------------------------------------------------------------------
+ * Taking a sample
+ *
+ * The thread stopped at a heap or stack check, or to block, so the top
+ * of its stack says what it was doing. When it stopped to enter or
+ * call the closure in R1, the generic code in HeapStackCheck.cmm left
+ * a frame with R1 in it, and we count the info table of that closure.
+ * When it stopped in a case alternative we count the continuation the
+ * alternative belongs to, which is the frame below the one saving the
+ * return value. Otherwise it's the info pointer at Sp.
+ * -------------------------------------------------------------------------- */
+
+void
+sampleInfoTable_ (Capability *cap, StgTSO *tso)
+{
+    StgStack *stack;
+    StgPtr sp;
+    StgWord info;
+
+    cap->sample_info = 0;
+
+    stack = tso->stackobj;
+    sp = stack->sp;
+    info = sp[0];
+
+    if (info == (W_)&stg_enter_info) {
+        info = (W_)UNTAG_CLOSURE((StgClosure *)sp[1])->header.info;
+    } else if (info == (W_)&stg_gc_fun_info) {
+        info = (W_)UNTAG_CLOSURE((StgClosure *)sp[2])->header.info;
+    } else if (info == (W_)&stg_gc_void_info ||
+               info == (W_)&stg_gc_unpt_r1_info ||
+               info == (W_)&stg_gc_unbx_r1_info ||
+               info == (W_)&stg_gc_f1_info ||
+               info == (W_)&stg_gc_d1_info ||
+               info == (W_)&stg_gc_l1_info) {
+        sp += stack_frame_sizeW((StgClosure *)sp);
+        if (sp < stack->stack + stack->stack_size) {
+            info = sp[0];
+        }
+    }
+
+    if (cap->info_samples == NULL) {
+        cap->info_samples = newInfoSamples();
+    }
+    addInfoSamples(cap->info_samples, info, 1);
+}
+
+/* -----------------------------------------------------------------------------
+ * The report
+ * -------------------------------------------------------------------------- */
+
+// Most samples first
+static int
+compareInfoSamples (const void *a, const void *b)
+{
+    StgWord64 count_a = ((StgWord64 *)a)[1];
+    StgWord64 count_b = ((StgWord64 *)b)[1];
+
+    return count_a < count_b ? 1 : count_a > count_b ? -1 : 0;
+}
+
+static FILE *
+openInfoTableProfile (void)
+{
+    char *prog, *filename;
+    FILE *file;
+
+    prog = stgMallocBytes(strlen(prog_name) + 1, "openInfoTableProfile");
+    strcpy(prog, prog_name);
+#ifdef mingw32_HOST_OS
+    // on Windows, drop the .exe suffix if there is one
+    {
+        char *suff;
+        suff = strrchr(prog,'.');
+        if (suff != NULL && !strcmp(suff,".exe")) {
+            *suff = '\0';
+        }
+    }
+#endif
+
+    filename = stgMallocBytes(strlen(prog) + 8, "openInfoTableProfile");
+    sprintf(filename, "%s.itprof", prog);
+    if ((file = fopen(filename, "w")) == NULL) {
+        errorBelch("Can't open profiling report file %s", filename);
+    }
+    stgFree(filename);
+    stgFree(prog);
+    return file;
+}
+
+void
+endInfoTableProfiling (void)
+{
+    InfoSamples *s, *total;
+    StgWord64 n_total, info, count;
+    FILE *file;
+    nat n, i;
+#ifdef USE_DWARF
+    StgBool symbolize;
+    DwarfProc *proc;
+#endif
+
+    if (!RtsFlags.ProfFlags.infoTableSamples) {
+        return;
+    }
+
+    total = newInfoSamples();
+    for (n = 0; n < n_capabilities; n++) {
+        s = capabilities[n].info_samples;
+        if (s == NULL) {
+            continue;
+        }
+        traceInfoTableSamples(&capabilities[n], s->n_samples, s->samples);
+        for (i = 0; i < s->n_samples; i++) {
+            addInfoSamples(total, s->samples[2*i], s->samples[2*i + 1]);
+        }
+        freeInfoSamples(s);
+        capabilities[n].info_samples = NULL;
+    }
+
+    qsort(total->samples, total->n_samples, 2 * sizeof(StgWord64),
+          compareInfoSamples);
+    n_total = 0;
+    for (i = 0; i < total->n_samples; i++) {
+        n_total += total->samples[2*i + 1];
+    }
+
+    file = openInfoTableProfile();
+    if (file != NULL) {
+#ifdef USE_DWARF
+        symbolize = dwarf_acquire_index();
+#endif
+        fprintf(file, "%s +RTS --info-table-samples: %" FMT_Word64
+                " samples, %d ms apart\n\n",
+                prog_name, n_total,
+                (int)TimeToUS(RtsFlags.MiscFlags.tickInterval) / 1000);
+        fprintf(file, "   samples      %%  info table          name\n");
+        for (i = 0; i < total->n_samples; i++) {
+            info = total->samples[2*i];
+            count = total->samples[2*i + 1];
+            fprintf(file, "%10" FMT_Word64 " %6.2f  %18p",
+                    count, 100.0 * count / n_total, (void *)(W_)info);
+#ifdef USE_DWARF
+            proc = symbolize ? dwarf_lookup_ip((void *)(W_)info) : NULL;
+            if (proc != NULL) {
+                fprintf(file, "  %s", proc->name);
+            }
+#endif
+            fprintf(file, "\n");
+        }
+#ifdef USE_DWARF
+        dwarf_release_index();
+#endif
+        fclose(file);
+    }
+
+    freeInfoSamples(total);
+}
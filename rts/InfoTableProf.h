@@ -0,0 +1,30 @@
+/* -----------------------------------------------------------------------------
+ *
+ * (c) The GHC Team, 2012
+ *
+ * Time profiling by info table, without -prof
+ *
+ * ---------------------------------------------------------------------------*/
+
+#ifndef INFOTABLEPROF_H
+#define INFOTABLEPROF_H
+
+#include "BeginPrivate.h"
+
+// The timer sets cap->sample_info on every tick (+RTS
+// --info-table-samples), and the scheduler takes the sample when the
+// running thread comes back to it.
+#define sampleInfoTable(cap, tso)               \
+    if (RTS_UNLIKELY((cap)->sample_info)) {     \
+        sampleInfoTable_(cap, tso);             \
+    }
+
+void sampleInfoTable_ (Capability *cap, StgTSO *tso);
+
+// Writes <prog>.itprof, and posts the samples to the eventlog if there
+// is one. Called at exit, once the capabilities have stopped.
+void endInfoTableProfiling (void);
+
+#include "EndPrivate.h"
+
+#endif /* INFOTABLEPROF_H */
@@ -28,6 +28,9 @@
 #include "Trace.h"
 #include "StgPrimFloat.h" // for __int_encodeFloat etc.
 #include "Stable.h"
+#if defined(USE_DWARF)
+#include "Dwarf.h"
+#endif
 
 #if !defined(mingw32_HOST_OS)
 #include "posix/Signals.h"
@@ -94,6 +97,7 @@
 #  define OBJFORMAT_ELF
 #  include <regex.h>    // regex is already used by dlopen() so this is OK
                         // to use here without requiring an additional lib
+#  include <unistd.h>   // getpid(), for /tmp/perf-<pid>.map
 #elif defined(cygwin32_HOST_OS) || defined (mingw32_HOST_OS)
 #  define OBJFORMAT_PEi386
 #  include <windows.h>
@@ -127,6 +131,12 @@ static /*Str*/HashTable *symhash;
 /* Hash table mapping symbol names to StgStablePtr */
 static /*Str*/HashTable *stablehash;
 
+#if defined(OBJFORMAT_ELF)
+/* /tmp/perf-<pid>.map, see registerCodeSymbols. Append-only: unloaded
+   objects stay listed, perf takes the latest entry for an address. */
+static FILE *perf_map = NULL;
+#endif
+
 /* List of currently loaded objects */
 ObjectCode *objects = NULL;     /* initially empty */
 
@@ -873,6 +883,7 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(rts_getFunPtr)                      \
       SymI_HasProto(rts_getStablePtr)                   \
       SymI_HasProto(rts_getThreadId)                    \
+      SymI_HasProto(rts_getThreadCounters)              \
       SymI_HasProto(rts_getWord)                        \
       SymI_HasProto(rts_getWord8)                       \
       SymI_HasProto(rts_getWord16)                      \
@@ -898,6 +909,9 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(rts_mkWord32)                       \
       SymI_HasProto(rts_mkWord64)                       \
       SymI_HasProto(rts_unlock)                         \
+      SymI_HasProto(rts_dumpEventLog)                   \
+      SymI_HasProto(rts_setEventLogSink)                \
+      SymI_HasProto(rts_setTraceClasses)                \
       SymI_HasProto(rts_unsafeGetMyCapability)          \
       SymI_HasProto(rtsSupportsBoundThreads)            \
       SymI_HasProto(rts_isProfiled)                     \
@@ -1005,6 +1019,7 @@ typedef struct _RtsSymbolVal {
       SymI_HasProto(n_capabilities)                     \
       SymI_HasProto(stg_traceCcszh)                     \
       SymI_HasProto(stg_traceEventzh)                   \
+      SymI_HasProto(stg_setTraceClasseszh)              \
       RTS_USER_SIGNALS_SYMBOLS                          \
       RTS_INTCHAR_SYMBOLS
 
@@ -1236,6 +1251,12 @@ exitLinker( void ) {
 #endif
    }
 #endif
+#if defined(OBJFORMAT_ELF)
+   if (perf_map != NULL) {
+      fclose(perf_map);
+      perf_map = NULL;
+   }
+#endif
 }
 
 /* -----------------------------------------------------------------------------
@@ -2287,6 +2308,14 @@ resolveObjs( void )
     IF_DEBUG(linker, debugBelch("resolveObjs: start\n"));
     initLinker();
 
+#if defined(USE_DWARF) && defined(TRACING)
+    /* samples in the objects loaded since last time can come in as
+       soon as we're done */
+    if (RtsFlags.TraceFlags.tracing) {
+        dwarf_update_index();
+    }
+#endif
+
     for (oc = objects; oc; oc = oc->next) {
         if (oc->status != OBJECT_RESOLVED) {
 #           if defined(OBJFORMAT_ELF)
@@ -2336,6 +2365,13 @@ unloadObj( char *path )
                 }
             }
 
+#if defined(USE_DWARF) && defined(TRACING)
+            /* something else might get loaded at the same address */
+            if (RtsFlags.TraceFlags.tracing) {
+                dwarf_remove_object(OC_INFORMATIVE_FILENAME(oc));
+            }
+#endif
+
             if (prev == NULL) {
                 objects = oc->next;
             } else {
@@ -3950,12 +3986,104 @@ static int getSectionKind_ELF( Elf_Shdr *hdr, int *is_bss )
     return SECTIONKIND_OTHER;
 }
 
+/* -----------------------------------------------------------------------------
+ * Telling profilers about the code we load.
+ *
+ * With +RTS --perf-map, the code symbols of every object are written to
+ * /tmp/perf-<pid>.map, which is where Linux perf looks for the symbols
+ * of code that doesn't come from a file.  When tracing with debug data
+ * (USE_DWARF), each object also gets a unit of its own, which is posted
+ * to the eventlog right away; resolveObjs adds them to the index that
+ * IP samples are looked up in.
+ */
+
+typedef struct {
+   char*   name;
+   char*   start;
+   char*   end;    /* of its section */
+   StgWord size;   /* 0 if the symbol table doesn't say */
+} CodeSymbol;
+
+static int
+wantCodeSymbols ( void )
+{
+#if defined(USE_DWARF) && defined(TRACING)
+   if (RtsFlags.TraceFlags.tracing) return 1;
+#endif
+   return RtsFlags.MiscFlags.perfMap;
+}
+
+static int
+compareCodeSymbols ( const void* a, const void* b )
+{
+   char* x = ((CodeSymbol*)a)->start;
+   char* y = ((CodeSymbol*)b)->start;
+   return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void
+registerCodeSymbols ( ObjectCode* oc, CodeSymbol* syms, int n )
+{
+   int   i, k;
+   char* next;
+#if defined(USE_DWARF) && defined(TRACING)
+   DwarfUnit* unit;
+#endif
+
+   /* Symbols without a size (assembler labels, like most of what GHC
+      generates) run up to the next symbol, or the end of the section. */
+   qsort(syms, n, sizeof(CodeSymbol), compareCodeSymbols);
+   for (i = 0; i < n; i++) {
+      if (syms[i].size != 0) continue;
+      for (k = i + 1; k < n && syms[k].start == syms[i].start; k++)
+         ;
+      next = syms[i].end;
+      if (k < n && syms[k].start < next) next = syms[k].start;
+      syms[i].size = next - syms[i].start;
+   }
+
+   if (RtsFlags.MiscFlags.perfMap && perf_map == NULL) {
+      char path[64];
+      sprintf(path, "/tmp/perf-%d.map", (int)getpid());
+      perf_map = fopen(path, "a");
+      if (perf_map == NULL) {
+         sysErrorBelch("registerCodeSymbols: can't open %s", path);
+         RtsFlags.MiscFlags.perfMap = rtsFalse;
+      }
+   }
+   if (perf_map != NULL) {
+      for (i = 0; i < n; i++) {
+         if (syms[i].size == 0) continue;
+         fprintf(perf_map, "%lx %lx %s\n", (unsigned long)syms[i].start,
+                 (unsigned long)syms[i].size, syms[i].name);
+      }
+      fflush(perf_map);
+   }
+
+#if defined(USE_DWARF) && defined(TRACING)
+   if (RtsFlags.TraceFlags.tracing) {
+      unit = dwarf_add_object(OC_INFORMATIVE_FILENAME(oc));
+      if (unit != NULL) {
+         for (i = 0; i < n; i++) {
+            if (syms[i].size == 0) continue;
+            dwarf_add_object_proc(unit, syms[i].name, syms[i].start,
+                                  syms[i].start + syms[i].size);
+         }
+         dwarf_trace_object(unit);
+      }
+   }
+#else
+   (void)oc;
+#endif
+}
 
 static int
 ocGetNames_ELF ( ObjectCode* oc )
 {
    int i, j, nent;
    Elf_Sym* stab;
+   CodeSymbol* code = NULL;
+   int n_code = 0;
 
    char*     ehdrC    = (char*)(oc->image);
    Elf_Ehdr* ehdr     = (Elf_Ehdr*)ehdrC;
@@ -4002,6 +4130,12 @@ ocGetNames_ELF ( ObjectCode* oc )
       oc->symbols = stgMallocBytes(oc->n_symbols * sizeof(char*),
                                    "ocGetNames_ELF(oc->symbols)");
 
+      if (wantCodeSymbols()) {
+         code = stgMallocBytes(nent * sizeof(CodeSymbol),
+                               "ocGetNames_ELF(code)");
+         n_code = 0;
+      }
+
       //TODO: we ignore local symbols anyway right? So we can use the
       //      shdr[i].sh_info to get the index of the first non-local symbol
       // ie we should use j = shdr[i].sh_info
@@ -4049,6 +4183,16 @@ ocGetNames_ELF ( ObjectCode* oc )
             }
             */
             ad = ehdrC + shdr[ secno ].sh_offset + stab[j].st_value;
+            /* local ones too: GHC's code is mostly local labels */
+            if (code != NULL && (shdr[secno].sh_flags & SHF_EXECINSTR)
+                && *nm != '\0') {
+               code[n_code].name  = nm;
+               code[n_code].start = ad;
+               code[n_code].end   = ehdrC + shdr[secno].sh_offset
+                                          + shdr[secno].sh_size;
+               code[n_code].size  = stab[j].st_size;
+               n_code++;
+            }
             if (ELF_ST_BIND(stab[j].st_info)==STB_LOCAL) {
                isLocal = TRUE;
             } else {
@@ -4093,6 +4237,12 @@ ocGetNames_ELF ( ObjectCode* oc )
          }
 
       }
+
+      if (code != NULL) {
+         registerCodeSymbols(oc, code, n_code);
+         stgFree(code);
+         code = NULL;
+      }
    }
 
    return 1;
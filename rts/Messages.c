@@ -258,6 +258,8 @@ loop:
         debugTraceCap(DEBUG_sched, cap, "thread %d blocked on thread %d", 
                       (lnat)msg->tso->id, (lnat)owner->id);
 
+        traceThreadBlocked(cap, msg->tso, BlockedOnBlackHole, bh, owner);
+
         return 1; // blocked
     }
     else if (info == &stg_BLOCKING_QUEUE_CLEAN_info || 
@@ -291,6 +293,8 @@ loop:
         debugTraceCap(DEBUG_sched, cap, "thread %d blocked on thread %d", 
                       (lnat)msg->tso->id, (lnat)owner->id);
 
+        traceThreadBlocked(cap, msg->tso, BlockedOnBlackHole, bh, owner);
+
         // See above, #3838
         if (owner->why_blocked == NotBlocked && owner->id != msg->tso->id) {
             removeFromRunQueue(cap, owner);
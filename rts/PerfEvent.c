@@ -7,8 +7,11 @@
 #include "Task.h"
 #include "RtsUtils.h"
 #include "Trace.h"
+#include "Stats.h"
+#include "Capability.h"
 
 #include <string.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
@@ -44,9 +47,86 @@
 //         having this set too high will cause EPERMs with too many tasks!
 #define PERF_EVENT_MMAP_PAGES 32
 
+// Counters read with every sample for -Eg, as a perf_event group led by
+// the cycle counter, which triggers the samples. Counters the CPU
+// doesn't have are left out.
+static const struct {
+	StgWord16 counter;
+	StgWord64 config;
+} perf_event_group[] = {
+	{ PERF_COUNTER_CYCLES,        PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_COUNTER_INSTRUCTIONS,  PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_COUNTER_CACHE_MISSES,  PERF_COUNT_HW_CACHE_MISSES },
+	{ PERF_COUNTER_BRANCH_MISSES, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+#define PERF_EVENT_GROUP_SIZE \
+	(sizeof(perf_event_group) / sizeof(perf_event_group[0]))
+
+// A counter of a counting group (-Ep, -Et)
+typedef struct {
+	StgWord16 counter;
+	StgWord32 type;
+	StgWord64 config;
+} PerfEventCounter;
+
+// Counted for the GC phases (-Ep), as a group led by the cache misses,
+// in the order of the gc_phase_* arrays of a gc_thread
+static const PerfEventCounter perf_event_gc_group[GC_PHASE_COUNTERS] = {
+	{ PERF_COUNTER_CACHE_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ PERF_COUNTER_DTLB_MISSES,  PERF_TYPE_HW_CACHE,
+	  PERF_COUNT_HW_CACHE_DTLB |
+	  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+};
+
+// Counted for each Haskell thread (-Et), in the order of the perf_*
+// fields of a TSO
+static const PerfEventCounter perf_event_thread_group[PERF_EVENT_THREAD_COUNTERS] = {
+	{ PERF_COUNTER_CYCLES,       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_COUNTER_INSTRUCTIONS, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_COUNTER_CACHE_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+};
+
+// Largest counting group
+#define PERF_EVENT_MAX_COUNTERS 4
+
+static int perf_event_open_counters(const PerfEventCounter *group, nat n,
+                                    StgWord16 *counters, int *members,
+                                    const char *what);
+static void perf_event_close_group(int *leader, int *members);
+static void perf_event_read_counters(int fd, StgWord16 counters,
+                                     const PerfEventCounter *group, nat n,
+                                     StgWord64 *values);
+
 #ifdef TRACING
 static size_t get_page_size(void);
-static void perf_event_stream(Task *task, StgBool own_task);
+static void perf_event_stream(Task *task, Capability *cap, StgBool own_task);
+static void perf_event_read_group(Task *task, Capability *cap, StgBool own_task,
+                                  StgWord8 *data, StgWord8 *end,
+                                  StgWord64 *samples);
+
+// Scratch space for draining a ring buffer: the first half takes the
+// samples of a ring that wrapped around, the second the samples we pass
+// on (which are never bigger than the records they come from). Only
+// one thread ever drains, so one buffer does, allocated up front so
+// that draining doesn't allocate.
+static StgWord8 *perf_event_scratch = NULL;
+
+#ifdef THREADED_RTS
+// Tasks with a ring buffer, for the reader thread (perf_event_mutex)
+static Mutex perf_event_mutex;
+static Task **perf_event_tasks = NULL;
+static nat perf_event_n_tasks = 0;
+static nat perf_event_max_tasks = 0;
+
+static StgBool perf_event_reader_running = rtsFalse;
+static StgBool perf_event_reader_stop = rtsFalse;
+static StgBool perf_event_reader_exited = rtsFalse;
+static Condition perf_event_reader_idle;
+
+static void perf_event_register(Task *task);
+#endif
 #endif
 
 static inline int
@@ -68,20 +148,58 @@ static size_t get_page_size(void)
 		return page_size = sysconf(_SC_PAGE_SIZE);
 	return page_size;
 }
+
+// Give up on sampling
+static void perf_event_close_sampling(Task *task)
+{
+	perf_event_close_group(&task->perf_event_fd, task->perf_event_member_fds);
+	task->perf_event_counters = 0;
+	task->perf_event_n_counters = 0;
+}
 #endif
 
 void perf_event_init(Task *task)
 {
+	nat i;
+
 	// Clear
 	task->perf_event_fd = -1;
 	task->perf_event_mmap = NULL;
 	task->perf_event_last_head = 0;
+	task->perf_event_counters = 0;
+	task->perf_event_n_counters = 0;
+	for (i = 0; i < PERF_EVENT_MAX_MEMBERS; i++) {
+		task->perf_event_member_fds[i] = -1;
+		task->perf_event_gc_member_fds[i] = -1;
+		task->perf_event_thread_member_fds[i] = -1;
+	}
+	task->perf_event_gc_fd = -1;
+	task->perf_event_gc_counters = 0;
+	task->perf_event_thread_fd = -1;
+	task->perf_event_thread_counters = 0;
+
+	if (RtsFlags.PerfEventFlags.gcPhases) {
+		task->perf_event_gc_fd =
+			perf_event_open_counters(perf_event_gc_group, GC_PHASE_COUNTERS,
+			                         &task->perf_event_gc_counters,
+			                         task->perf_event_gc_member_fds,
+			                         "the GC counters");
+	}
+	if (RtsFlags.PerfEventFlags.threadCounters) {
+		task->perf_event_thread_fd =
+			perf_event_open_counters(perf_event_thread_group,
+			                         PERF_EVENT_THREAD_COUNTERS,
+			                         &task->perf_event_thread_counters,
+			                         task->perf_event_thread_member_fds,
+			                         "the thread counters");
+	}
 
 #ifdef TRACING
 	// Enabled?
 	if (0 == RtsFlags.PerfEventFlags.sampleType) {
 		return;
 	}
+	StgBool group = RtsFlags.PerfEventFlags.sampleType == PERF_EVENT_SAMPLE_GROUP;
 	
 	// Initialize perf_event attributes
 	struct perf_event_attr attr;
@@ -92,6 +210,14 @@ void perf_event_init(Task *task)
 	attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID;
 	attr.exclude_kernel = 1;
 	attr.disabled = 1;
+	// Wake up the reader thread when the ring is half full
+	attr.watermark = 1;
+	attr.wakeup_watermark = get_page_size() * PERF_EVENT_MMAP_PAGES / 2;
+	if (group) {
+		// Have every sample carry the values of the whole group
+		attr.sample_type |= PERF_SAMPLE_READ;
+		attr.read_format = PERF_FORMAT_GROUP;
+	}
 
 	// Allocate counter
 	task->perf_event_fd = sys_perf_event_open(&attr, 0, -1, -1, 0);
@@ -100,12 +226,33 @@ void perf_event_init(Task *task)
 		return;
 	}
 
-	// Test
-	StgWord64 val;
-	if (read(task->perf_event_fd, &val, sizeof(val)) <= 0) {
+	// Add the other counters to the group. They are enabled and
+	// disabled together with the leader.
+	if (group) {
+		int fd;
+		ASSERT(PERF_EVENT_GROUP_SIZE <= PERF_EVENT_MAX_MEMBERS + 1);
+		task->perf_event_counters = perf_event_group[0].counter;
+		task->perf_event_n_counters = 1;
+		for (i = 1; i < PERF_EVENT_GROUP_SIZE; i++) {
+			struct perf_event_attr member;
+			memset(&member, 0, sizeof(member));
+			member.type = PERF_TYPE_HARDWARE;
+			member.config = perf_event_group[i].config;
+			member.exclude_kernel = 1;
+			fd = sys_perf_event_open(&member, 0, -1, task->perf_event_fd, 0);
+			if (fd >= 0) {
+				task->perf_event_member_fds[i-1] = fd;
+				task->perf_event_counters |= perf_event_group[i].counter;
+				task->perf_event_n_counters++;
+			}
+		}
+	}
+
+	// Test (a group is read as a count followed by the values)
+	StgWord64 val[1 + PERF_EVENT_GROUP_SIZE];
+	if (read(task->perf_event_fd, val, sizeof(val)) <= 0) {
 		sysErrorBelch("Could not read from perf_event");
-		close(task->perf_event_fd);
-		task->perf_event_fd = -1;
+		perf_event_close_sampling(task);
 		return;
 	}
 
@@ -115,18 +262,125 @@ void perf_event_init(Task *task)
 		mmap(NULL, mmap_length, PROT_READ | PROT_WRITE, MAP_SHARED, task->perf_event_fd, 0);
 	if (task->perf_event_mmap == MAP_FAILED) {
 		sysErrorBelch("Could not allocate memory-map for perf_event");
+		task->perf_event_mmap = NULL;
+		perf_event_close_sampling(task);
 		return;
 	}
 
 	// Start following the stream
 	task->perf_event_last_head = task->perf_event_data->data_head;
 	task->perf_event_data->data_tail = task->perf_event_last_head;
+
+#ifdef THREADED_RTS
+	perf_event_register(task);
+#else
+	if (perf_event_scratch == NULL) {
+		perf_event_scratch = stgMallocBytes(2 * get_page_size() * PERF_EVENT_MMAP_PAGES,
+		                                    "perf_event_init");
+	}
+#endif
+#endif
+
+}
+
+// Opens a counting group of the calling thread, led by the first
+// counter. The counters run all the time, we read them where we want
+// to know what happened in between. Counters the CPU doesn't have are
+// left out; *counters says which ones we got, and members gets the fds
+// of the others than the leader. Returns the group's fd, or -1 if the
+// leader can't be opened.
+static int perf_event_open_counters(const PerfEventCounter *group, nat n,
+                                    StgWord16 *counters, int *members,
+                                    const char *what)
+{
+	struct perf_event_attr attr;
+	int leader = -1;
+	nat i;
+	int fd;
+
+	ASSERT(n <= PERF_EVENT_MAX_MEMBERS + 1);
+	for (i = 0; i < n; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.type = group[i].type;
+		attr.config = group[i].config;
+		attr.exclude_kernel = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+		fd = sys_perf_event_open(&attr, 0, -1, leader, 0);
+		if (fd < 0) {
+			if (i == 0) {
+				sysErrorBelch("Could not open perf_event for %s", what);
+				return -1;
+			}
+			continue;
+		}
+		if (i == 0) {
+			leader = fd;
+		} else {
+			members[i-1] = fd;
+		}
+		*counters |= group[i].counter;
+	}
+	return leader;
+}
+
+// Closes a group, members first
+static void perf_event_close_group(int *leader, int *members)
+{
+	nat i;
+
+	for (i = 0; i < PERF_EVENT_MAX_MEMBERS; i++) {
+		if (members[i] >= 0) {
+			close(members[i]);
+			members[i] = -1;
+		}
+	}
+	if (*leader >= 0) {
+		close(*leader);
+		*leader = -1;
+	}
+}
+
+void perf_event_free_task(Task *task)
+{
+	perf_event_close_group(&task->perf_event_gc_fd,
+	                       task->perf_event_gc_member_fds);
+	perf_event_close_group(&task->perf_event_thread_fd,
+	                       task->perf_event_thread_member_fds);
+#ifdef TRACING
+	if (task->perf_event_mmap != NULL) {
+		munmap(task->perf_event_mmap,
+		       get_page_size() * (PERF_EVENT_MMAP_PAGES + 1));
+		task->perf_event_mmap = NULL;
+	}
 #endif
+	perf_event_close_group(&task->perf_event_fd, task->perf_event_member_fds);
+}
+
+// Current values of a group opened by perf_event_open_counters, in the
+// order of the group. Those we don't have read as 0.
+static void perf_event_read_counters(int fd, StgWord16 counters,
+                                     const PerfEventCounter *group, nat n,
+                                     StgWord64 *values)
+{
+	StgWord64 buf[1 + PERF_EVENT_MAX_COUNTERS];
+	nat i, j;
+
+	for (i = 0; i < n; i++) {
+		values[i] = 0;
+	}
+	if (fd == -1) return;
+	if (read(fd, buf, sizeof(buf)) <= 0) return;
 
+	// A group is read as the number of counters, then their values
+	for (i = 0, j = 1; i < n && j <= buf[0]; i++) {
+		if (counters & group[i].counter) {
+			values[i] = buf[j++];
+		}
+	}
 }
 
 #ifdef TRACING
-void perf_event_stream(Task *task, StgBool own_task) {
+void perf_event_stream(Task *task, Capability *cap, StgBool own_task) {
 
 	// Read new head pointer
 	StgWord64 last_head = task->perf_event_last_head;
@@ -141,21 +395,23 @@ void perf_event_stream(Task *task, StgBool own_task) {
 	StgWord64 buf_mask = buf_size - 1; // Assuming page size is a power of 2, obviously.
 	StgWord8 *data_base = ((StgWord8 *)task->perf_event_mmap) + get_page_size();
 	StgWord8 *data = data_base + (last_head & buf_mask);
-	StgBool free_data = 0;
 
-	// Wrap around? Play it safe: Assemble into a new buffer
+	// The kernel doesn't overwrite what we haven't read, but be careful
+	if (new_head - last_head > buf_size) {
+		new_head = last_head + buf_size;
+	}
+
+	// Wrap around? Play it safe: Assemble into the scratch buffer
 	if ((last_head & ~buf_mask) != (new_head & ~buf_mask)) {
 
 		StgWord64 bytes_before_wrap = buf_size - (last_head & buf_mask);
 		StgWord64 bytes_after_wrap  = new_head & buf_mask;
 
-		//printf("last:%ld new:%ld mask:%ld before:%ld after:%ld\n", last_head, new_head, buf_mask, bytes_before_wrap, bytes_after_wrap);
-		StgWord8 *new_data = stgMallocBytes(new_head - last_head, "perf_event_stream wrap buffer");
-		memcpy(new_data, data, bytes_before_wrap);
-		memcpy(new_data + bytes_before_wrap, data_base, bytes_after_wrap);
-		data = new_data;
-		free_data = 1;
+		memcpy(perf_event_scratch, data, bytes_before_wrap);
+		memcpy(perf_event_scratch + bytes_before_wrap, data_base, bytes_after_wrap);
+		data = perf_event_scratch;
 	}
+	StgWord64 *samples = (StgWord64 *) (perf_event_scratch + buf_size);
 
 	// Count number of samples
 	StgWord32 n_samples = 0;
@@ -177,35 +433,137 @@ void perf_event_stream(Task *task, StgBool own_task) {
 
 	// Read samples
 	pos = data;
-	void **ips = (void **) stgMallocBytes(sizeof(void *) * n_samples, "perf_event_stream samples");
-	StgWord32 i = 0;
-	while (pos != end_pos) {
-		struct perf_event_header *hdr = (struct perf_event_header *) pos;
-		if (hdr->type == PERF_RECORD_SAMPLE) {
-			ips[i++] = (void *) *((StgWord64 *) (pos + hdr_size));
+	if (task->perf_event_counters) {
+		perf_event_read_group(task, cap, own_task, data, end_pos, samples);
+	} else {
+		void **ips = (void **) samples;
+		StgWord32 i = 0;
+		while (pos != end_pos) {
+			struct perf_event_header *hdr = (struct perf_event_header *) pos;
+			if (hdr->type == PERF_RECORD_SAMPLE) {
+				ips[i++] = (void *) *((StgWord64 *) (pos + hdr_size));
+			}
+			pos += hdr->size;
 		}
-		pos += hdr->size;
-	}
 
-	// Output samples
-	traceInstrPtrSample(task->cap, own_task, n_samples, ips);
-	stgFree(ips);
+		// Output samples
+		traceInstrPtrSample(cap, own_task, n_samples, ips);
+	}
 
 	// Our final head (for incomplete data we might not have read everyhing!)
 	// Note corrupt data might cause us to get stuck here...
 	StgWord64 final_head = last_head + (end_pos - data);
 
-	// Free buffer
-	if (free_data)
-		stgFree(data);
-
-	//printf("new %ld final %ld\n", new_head, final_head);
-
 	// Advance head pointer
 	task->perf_event_last_head = final_head;
 	task->perf_event_data->data_tail = final_head;
 }
 
+// Sample records of a group are laid out as
+//
+//   header, ip:64, pid:32, tid:32, nr:64, nr * value:64
+//
+// We pass on the ip and the values, in group order.
+void perf_event_read_group(Task *task, Capability *cap, StgBool own_task,
+                           StgWord8 *data, StgWord8 *end,
+                           StgWord64 *samples)
+{
+	nat n_counters = task->perf_event_n_counters;
+	StgWord64 *out = samples;
+	StgWord8 *pos = data;
+	StgWord32 i = 0;
+	nat j;
+
+	while (pos != end) {
+		struct perf_event_header *hdr = (struct perf_event_header *) pos;
+		StgWord64 *rec = (StgWord64 *) (pos + sizeof(struct perf_event_header));
+		if (hdr->type == PERF_RECORD_SAMPLE &&
+		    hdr->size >= sizeof(*hdr) + (3 + n_counters) * sizeof(StgWord64) &&
+		    rec[2] == n_counters) {
+			*out++ = rec[0];
+			for (j = 0; j < n_counters; j++) {
+				*out++ = rec[3 + j];
+			}
+			i++;
+		}
+		pos += hdr->size;
+	}
+
+	tracePerfSample(cap, own_task, task->perf_event_counters,
+	                n_counters, i, samples);
+}
+
+#ifdef THREADED_RTS
+
+static void perf_event_register(Task *task)
+{
+	ACQUIRE_LOCK(&perf_event_mutex);
+	if (perf_event_n_tasks == perf_event_max_tasks) {
+		perf_event_max_tasks = perf_event_max_tasks ? 2 * perf_event_max_tasks : 16;
+		perf_event_tasks = stgReallocBytes(perf_event_tasks,
+		                                   perf_event_max_tasks * sizeof(Task *),
+		                                   "perf_event_register");
+	}
+	perf_event_tasks[perf_event_n_tasks++] = task;
+	RELEASE_LOCK(&perf_event_mutex);
+}
+
+// Drain the ring buffers of all tasks that have a capability to post
+// the samples for. The rings of the others keep their samples until
+// next time.
+static void perf_event_drain(void)
+{
+	Capability *cap;
+	nat i;
+	for (i = 0; i < perf_event_n_tasks; i++) {
+		cap = perf_event_tasks[i]->cap;
+		if (cap != NULL) {
+			perf_event_stream(perf_event_tasks[i], cap, 0);
+		}
+	}
+}
+
+static void OSThreadProcAttr
+perf_event_reader(void *unused STG_UNUSED)
+{
+	int timeout = TimeToUS(RtsFlags.MiscFlags.tickInterval) / 1000;
+	struct pollfd *fds = NULL;
+	nat i, n, max_fds = 0;
+
+	if (timeout < 1) {
+		timeout = 1;
+	}
+
+	ACQUIRE_LOCK(&perf_event_mutex);
+	while (!perf_event_reader_stop) {
+		n = perf_event_n_tasks;
+		if (n > max_fds) {
+			max_fds = perf_event_max_tasks;
+			fds = stgReallocBytes(fds, max_fds * sizeof(struct pollfd),
+			                      "perf_event_reader");
+		}
+		for (i = 0; i < n; i++) {
+			fds[i].fd = perf_event_tasks[i]->perf_event_fd;
+			fds[i].events = POLLIN;
+		}
+		RELEASE_LOCK(&perf_event_mutex);
+
+		// Sleep until a ring is half full, or for a tick, so that the
+		// samples don't get too old and new tasks are picked up
+		poll(fds, n, timeout);
+
+		ACQUIRE_LOCK(&perf_event_mutex);
+		perf_event_drain();
+	}
+	perf_event_reader_exited = rtsTrue;
+	signalCondition(&perf_event_reader_idle);
+	RELEASE_LOCK(&perf_event_mutex);
+
+	stgFree(fds);
+}
+
+#endif // THREADED_RTS
+
 #endif // TRACING
 
 void perf_event_start_mutator_count(void)
@@ -220,26 +578,209 @@ void perf_event_stop_mutator_count(void)
 	Task *task = myTask();
 	if(!task || task->perf_event_fd == -1) return;	
 	ioctl(task->perf_event_fd, PERF_EVENT_IOC_DISABLE);
+#if defined(TRACING) && !defined(THREADED_RTS)
+	// No reader thread: drain the ring while we are at it
+	if (task->cap != NULL) {
+		perf_event_stream(task, task->cap, 1);
+	}
+#endif
+}
+
+// Current values of the GC counters of the calling task, in the order
+// of perf_event_gc_group
+static void perf_event_gc_read(StgWord64 *values)
+{
+	Task *task = myTask();
+	perf_event_read_counters(task ? task->perf_event_gc_fd : -1,
+	                         task ? task->perf_event_gc_counters : 0,
+	                         perf_event_gc_group, GC_PHASE_COUNTERS, values);
+}
+
+void perf_event_gc_start(gc_thread *t)
+{
+	if (!RtsFlags.PerfEventFlags.gcPhases) return;
+	perf_event_gc_read(t->gc_phase_start);
+	memset(t->gc_phase_counts, 0, sizeof(t->gc_phase_counts));
+	t->gc_phase = GC_PHASE_OTHER;
+}
+
+// What was counted since the last switch goes to the phase we leave
+void perf_event_gc_phase(gc_thread *t, nat phase)
+{
+	StgWord64 now[GC_PHASE_COUNTERS];
+	nat i;
+
+	if (!RtsFlags.PerfEventFlags.gcPhases) return;
+	perf_event_gc_read(now);
+	for (i = 0; i < GC_PHASE_COUNTERS; i++) {
+		if (now[i] >= t->gc_phase_start[i]) {
+			t->gc_phase_counts[t->gc_phase][i] += now[i] - t->gc_phase_start[i];
+		}
+		t->gc_phase_start[i] = now[i];
+	}
+	t->gc_phase = phase;
+}
+
+// Adds the counts of this GC to the totals for +RTS -s, and posts them
+// when tracing GC events. Called by each GC thread before it lets go
+// of its capability.
+void perf_event_gc_end(gc_thread *t)
+{
+	nat p, i;
+
+	if (!RtsFlags.PerfEventFlags.gcPhases) return;
+	perf_event_gc_phase(t, GC_PHASE_OTHER);
+
+	for (p = 0; p < NUM_GC_PHASES; p++) {
+		for (i = 0; i < GC_PHASE_COUNTERS; i++) {
+			t->gc_phase_totals[p][i] += t->gc_phase_counts[p][i];
+		}
 #ifdef TRACING
-	perf_event_stream(task, 1);
+		if (RTS_UNLIKELY(TRACE_gc) &&
+		    (t->gc_phase_counts[p][0] || t->gc_phase_counts[p][1])) {
+			traceGcPhaseCounters_(t->cap, t->thread_index, p,
+			                      t->gc_phase_counts[p][0],
+			                      t->gc_phase_counts[p][1]);
+		}
 #endif
+	}
 }
 
-void
-perf_event_timer(void)
+// A Haskell thread starts running on the task
+void perf_event_run_thread(Task *task)
 {
+	if (task->perf_event_thread_fd == -1) return;
+	perf_event_read_counters(task->perf_event_thread_fd,
+	                         task->perf_event_thread_counters,
+	                         perf_event_thread_group, PERF_EVENT_THREAD_COUNTERS,
+	                         task->perf_event_thread_start);
+}
 
+// The Haskell thread the task ran has stopped: what was counted since
+// perf_event_run_thread goes to the thread, and to the eventlog when
+// tracing the scheduler
+void perf_event_stop_thread(Capability *cap STG_UNUSED, Task *task, StgTSO *tso)
+{
+	StgWord64 now[PERF_EVENT_THREAD_COUNTERS];
+	StgWord64 delta[PERF_EVENT_THREAD_COUNTERS];
+	nat i;
+
+	if (task->perf_event_thread_fd == -1) return;
+	perf_event_read_counters(task->perf_event_thread_fd,
+	                         task->perf_event_thread_counters,
+	                         perf_event_thread_group, PERF_EVENT_THREAD_COUNTERS,
+	                         now);
+	for (i = 0; i < PERF_EVENT_THREAD_COUNTERS; i++) {
+		delta[i] = now[i] >= task->perf_event_thread_start[i]
+			? now[i] - task->perf_event_thread_start[i] : 0;
+	}
+	tso->perf_cycles       += delta[0];
+	tso->perf_instructions += delta[1];
+	tso->perf_cache_misses += delta[2];
 #ifdef TRACING
-	Task *task = all_tasks;
+	if (RTS_UNLIKELY(TRACE_sched)) {
+		traceThreadCounters_(cap, tso, delta[0], delta[1], delta[2]);
+	}
+#endif
+}
+
+void perf_event_gc_stats_report(void)
+{
+	static const char *counter_names[GC_PHASE_COUNTERS] = {
+		"cache misses", "dTLB misses"
+	};
+	static const char *phase_names[NUM_GC_PHASES] = {
+		"roots", "scavenge", "weak", "compact", "nursery", "other"
+	};
+	StgWord64 total[NUM_GC_PHASES];
+	gc_thread *t;
+	nat c, i, p;
+
+	if (!RtsFlags.PerfEventFlags.gcPhases) return;
+
+	for (c = 0; c < GC_PHASE_COUNTERS; c++) {
+		statsPrintf("  GC %-13s", counter_names[c]);
+		for (p = 0; p < NUM_GC_PHASES; p++) {
+			statsPrintf(" %10s", phase_names[p]);
+			total[p] = 0;
+		}
+		statsPrintf("\n");
+
+		for (i = 0; i < n_capabilities; i++) {
+			t = gc_threads[i];
+			statsPrintf("    thread %3d    ", i);
+			for (p = 0; p < NUM_GC_PHASES; p++) {
+				statsPrintf(" %10" FMT_Word64, t->gc_phase_totals[p][c]);
+				total[p] += t->gc_phase_totals[p][c];
+			}
+			statsPrintf("\n");
+		}
+
+		statsPrintf("    total         ");
+		for (p = 0; p < NUM_GC_PHASES; p++) {
+			statsPrintf(" %10" FMT_Word64, total[p]);
+		}
+		statsPrintf("\n\n");
+	}
+}
+
+void perf_event_start_reader(void)
+{
+#if defined(TRACING) && defined(THREADED_RTS)
+	OSThreadId tid;
+
+	if (0 == RtsFlags.PerfEventFlags.sampleType) {
+		return;
+	}
+	initMutex(&perf_event_mutex);
+
+	perf_event_scratch = stgMallocBytes(2 * get_page_size() * PERF_EVENT_MMAP_PAGES,
+	                                    "perf_event_start_reader");
+	perf_event_reader_stop = rtsFalse;
+	perf_event_reader_exited = rtsFalse;
+	initCondition(&perf_event_reader_idle);
+
+	if (createOSThread(&tid, perf_event_reader, NULL) != 0) {
+		sysErrorBelch("Could not start perf_event reader thread");
+		return;
+	}
+	perf_event_reader_running = rtsTrue;
+#endif
+}
+
+void perf_event_stop_reader(void)
+{
+#if defined(TRACING) && defined(THREADED_RTS)
+	if (!perf_event_reader_running) {
+		return;
+	}
 
-	// This is slightly unsafe. One of the tasks in question might get
-	// an overflow, and then we have duplicated instruction
-	// pointer samples.
-	for (task = all_tasks; task; task = task->next) {
-		perf_event_stream(task, 0);
+	ACQUIRE_LOCK(&perf_event_mutex);
+	perf_event_reader_stop = rtsTrue;
+	while (!perf_event_reader_exited) {
+		waitCondition(&perf_event_reader_idle, &perf_event_mutex);
 	}
+	// Pick up what came in since the last round
+	perf_event_drain();
+	RELEASE_LOCK(&perf_event_mutex);
+
+	perf_event_reader_running = rtsFalse;
+	closeCondition(&perf_event_reader_idle);
 #endif
+}
 
+void perf_event_fork_child(void)
+{
+#if defined(TRACING) && defined(THREADED_RTS)
+	// The reader thread is gone, and so are the threads whose samples
+	// it read
+	if (0 == RtsFlags.PerfEventFlags.sampleType) {
+		return;
+	}
+	initMutex(&perf_event_mutex);
+	perf_event_n_tasks = 0;
+	perf_event_reader_running = rtsFalse;
+#endif
 }
 
 #endif // USE_PERF_EVENT
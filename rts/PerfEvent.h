@@ -1,17 +1,50 @@
-
 #ifndef PERF_EVENT_H
 #define PERF_EVENT_H
 
 #include "BeginPrivate.h"
 
 #include "Task.h"
+#include "sm/GCThread.h"
+
+#ifdef USE_PERF_EVENT
 
 void perf_event_init(Task *task);
 
+// Closes the counters of a task that is being freed; the reader must
+// have been stopped
+void perf_event_free_task(Task *task);
+
 void perf_event_start_mutator_count(void);
 void perf_event_stop_mutator_count(void);
 
-void perf_event_timer(void);
+// The samples of all tasks are read by a thread of their own in the
+// threaded RTS (and when counting stops in the non-threaded one)
+void perf_event_start_reader(void);
+void perf_event_stop_reader(void);
+void perf_event_fork_child(void);
+
+// Cache and TLB misses per GC phase (-Ep). Each GC thread starts
+// counting when it joins the GC, and switches between the GC_PHASE_*
+// phases as it goes.
+void perf_event_gc_start(gc_thread *t);
+void perf_event_gc_phase(gc_thread *t, nat phase);
+void perf_event_gc_end(gc_thread *t);
+void perf_event_gc_stats_report(void);
+
+// Cycles, instructions and cache misses per Haskell thread (-Et),
+// counted between these two and added up in the TSO
+void perf_event_run_thread(Task *task);
+void perf_event_stop_thread(Capability *cap, Task *task, StgTSO *tso);
+
+#else
+
+#define perf_event_gc_start(t)        /* nothing */
+#define perf_event_gc_phase(t, phase) /* nothing */
+#define perf_event_gc_end(t)          /* nothing */
+#define perf_event_run_thread(task)   /* nothing */
+#define perf_event_stop_thread(cap, task, tso) /* nothing */
+
+#endif // USE_PERF_EVENT
 
 #include "EndPrivate.h"
 
@@ -205,13 +205,17 @@ check_target:
     traceThreadStatus(DEBUG_sched, target);
 #endif
 
+    status = target->why_blocked;
+
+    // A thread that another Capability stole from us gets its new cap
+    // before anything else changes (see takeExportedThread()), so read
+    // the cap last: if it is still ours, so is the status.
+    load_load_barrier();
     target_cap = target->cap;
-    if (target->cap != cap) {
+    if (target_cap != cap) {
         throwToSendMsg(cap, target_cap, msg);
         return THROWTO_BLOCKED;
     }
-
-    status = target->why_blocked;
     
     switch (status) {
     case NotBlocked:
@@ -335,6 +339,7 @@ check_target:
 	    return THROWTO_BLOCKED;
 	} else {
             // revoke the MVar operation
+            traceThreadUnblocked(cap, target, (StgClosure *)mvar, NULL);
             removeFromMVarBlockedQueue(target);
 	    raiseAsync(cap, target, msg->exception, rtsFalse, NULL);
 	    unlockClosure((StgClosure *)mvar, info);
@@ -354,6 +359,7 @@ check_target:
             // message from the owner of the blackhole some time in the
             // future, but that doesn't matter.
             ASSERT(target->block_info.bh->header.info == &stg_MSG_BLACKHOLE_info);
+            traceThreadUnblocked(cap, target, target->block_info.bh->bh, NULL);
             OVERWRITE_INFO(target->block_info.bh, &stg_IND_info);
             raiseAsync(cap, target, msg->exception, rtsFalse, NULL);
             return THROWTO_SUCCESS;
@@ -427,6 +433,20 @@ check_target:
 #endif
 
     case ThreadMigrating:
+#if defined(THREADED_RTS)
+        if (target->flags & TSO_EXPORTED) {
+            // we exported it (see exportThread()).  Take it back if
+            // nobody has stolen it yet; if someone has, its cap is
+            // about to change.
+            reclaimExportedThreads(cap);
+            goto retry;
+        }
+        // a thief clears TSO_EXPORTED after setting the cap
+        load_load_barrier();
+        if (target->cap != cap) {
+            goto retry;
+        }
+#endif
         // if is is ThreadMigrating and tso->cap is ours, then it
         // *must* be migrating *to* this capability.  If it were
         // migrating away from the capability, then tso->cap would
@@ -631,11 +651,13 @@ removeFromQueues(Capability *cap, StgTSO *tso)
     goto done;
 
   case BlockedOnMVar:
+      traceThreadUnblocked(cap, tso, tso->block_info.closure, NULL);
       removeFromMVarBlockedQueue(tso);
       goto done;
 
   case BlockedOnBlackHole:
-      // nothing to do
+      // nothing to do, apart from telling the eventlog
+      traceThreadUnblocked(cap, tso, tso->block_info.bh->bh, NULL);
       goto done;
 
   case BlockedOnMsgThrowTo:
@@ -17,6 +17,8 @@
 #include "Capability.h"
 #include "Stable.h"
 #include "Weak.h"
+#include "eventlog/EventLog.h"
+#include "Trace.h"
 
 /* ----------------------------------------------------------------------------
    Building Haskell objects from C datatypes.
@@ -587,3 +589,37 @@ rts_unlock (Capability *cap)
     boundTaskExiting(task);
     RELEASE_LOCK(&cap->lock);
 }
+
+void
+rts_setEventLogSink (const EventLogSink *sink)
+{
+#ifdef TRACING
+    setEventLogSink(sink);
+#else
+    (void)sink;   /* keep gcc -Wall happy */
+#endif
+}
+
+HsWord
+rts_setTraceClasses (HsWord on, HsWord off)
+{
+#ifdef TRACING
+    return setTraceClasses(on, off);
+#else
+    (void)on; (void)off;   /* keep gcc -Wall happy */
+    return 0;
+#endif
+}
+
+void
+rts_dumpEventLog (void)
+{
+#ifdef TRACING
+    if (RtsFlags.TraceFlags.ringSize != 0) {
+        // The dump itself happens during the GC, when all the
+        // capabilities are stopped.
+        requestEventLogDump();
+        performGC();
+    }
+#endif
+}
@@ -150,6 +150,7 @@ void initRtsFlagsDefaults(void)
 #endif /* PROFILING */
 
     RtsFlags.ProfFlags.doHeapProfile      = rtsFalse;
+    RtsFlags.ProfFlags.infoTableSamples   = rtsFalse;
     RtsFlags.ProfFlags. heapProfileInterval = USToTime(100000); // 100ms
 
 #ifdef PROFILING
@@ -174,6 +175,21 @@ void initRtsFlagsDefaults(void)
     RtsFlags.TraceFlags.sparks_sampled= rtsFalse;
     RtsFlags.TraceFlags.sparks_full   = rtsFalse;
     RtsFlags.TraceFlags.user          = rtsFalse;
+    RtsFlags.TraceFlags.asyncWriter   = rtsFalse;
+    RtsFlags.TraceFlags.asyncBuffers  = 4;
+    RtsFlags.TraceFlags.ringSize      = 0;
+    RtsFlags.TraceFlags.sink          = EVENTLOG_SINK_FILE;
+    RtsFlags.TraceFlags.sinkFd        = -1;
+    RtsFlags.TraceFlags.sinkPath      = NULL;
+    RtsFlags.TraceFlags.compact       = rtsFalse;
+    RtsFlags.TraceFlags.rotateSize    = 0;
+    RtsFlags.TraceFlags.rotateTime    = 0;
+    RtsFlags.TraceFlags.index         = rtsFalse;
+    RtsFlags.TraceFlags.tsc           = rtsFalse;
+    RtsFlags.TraceFlags.symbolize     = rtsFalse;
+    RtsFlags.TraceFlags.dwarfCache    = NULL;
+    RtsFlags.TraceFlags.dwarfAsync    = rtsFalse;
+    RtsFlags.TraceFlags.stackSampleDepth = 0;
 #endif
 
 #ifdef PROFILING
@@ -187,6 +203,7 @@ void initRtsFlagsDefaults(void)
     RtsFlags.MiscFlags.install_signal_handlers = rtsTrue;
     RtsFlags.MiscFlags.machineReadable = rtsFalse;
     RtsFlags.MiscFlags.linkerMemBase    = 0;
+    RtsFlags.MiscFlags.perfMap          = rtsFalse;
 
 #ifdef THREADED_RTS
     RtsFlags.ParFlags.nNodes	        = 1;
@@ -216,6 +233,15 @@ void initRtsFlagsDefaults(void)
 	RtsFlags.PapiFlags.samplePeriod     = 0;
 #endif
 #endif
+
+#ifdef USE_PERF_EVENT
+#ifdef TRACING
+	RtsFlags.PerfEventFlags.sampleType   = 0;
+	RtsFlags.PerfEventFlags.samplePeriod = 0;
+#endif
+	RtsFlags.PerfEventFlags.gcPhases     = rtsFalse;
+	RtsFlags.PerfEventFlags.threadCounters = rtsFalse;
+#endif
 }
 
 static const char *
@@ -317,6 +343,53 @@ usage_text[] = {
 #  endif
 "               -x    disable an event class, for any flag above",
 "             the initial enabled event classes are 'sgpu'",
+#  ifdef THREADED_RTS
+"  --eventlog-async[=<n>]",
+"             Write the eventlog from a background thread, using <n>",
+"             spare event buffers (default: 4)",
+#  endif
+"  --eventlog-ring=<size>",
+"             With -l, keep only the most recent <size> bytes of events",
+"             per capability in memory, and write them out at exit, on",
+"             SIGUSR2 or when rts_dumpEventLog() is called (e.g. 8m)",
+"  --eventlog-compact",
+"             Write the eventlog in the compact block format",
+#  if defined(i386_HOST_ARCH) || defined(x86_64_HOST_ARCH)
+"  --eventlog-tsc",
+"             Timestamp events with the CPU's time stamp counter, if it",
+"             is invariant, rather than with the OS clock",
+#  endif
+"  --eventlog-index",
+"             Append an index of the event blocks to the eventlog",
+"  --eventlog-rotate-size=<size>",
+"             Start a new eventlog file <program>.<pid>.<n>.eventlog",
+"             whenever the current one reaches <size> bytes (e.g. 1g)",
+"  --eventlog-rotate-time=<secs>",
+"             Start a new eventlog file every <secs> seconds",
+"  --eventlog-stack-sample[=<n>]",
+"             On every timer tick, log the innermost <n> frames of the",
+"             stack of each running Haskell thread (default: 32)",
+#  ifdef USE_DWARF
+"  --eventlog-symbolize",
+"             Look up instruction pointer samples in the debug data and",
+"             only log the number of samples per procedure, at exit",
+"  --eventlog-dwarf-cache=<dir>",
+"             Cache the debug data read at startup in <dir>, to be",
+"             read from there by later runs of the same binaries",
+#   ifdef THREADED_RTS
+"  --eventlog-dwarf-async",
+"             Read the debug data in the background, without delaying",
+"             the start of the program",
+#   endif
+#  endif
+#  if !defined(mingw32_HOST_OS)
+"  --eventlog-fd=<n>",
+"             Write the eventlog to the inherited file descriptor <n>",
+"  --eventlog-pipe=<path>",
+"             Write the eventlog to the named pipe <path>",
+"  --eventlog-socket=<path>",
+"             Write the eventlog to the Unix domain socket <path>",
+#  endif
 #endif
 
 #if !defined(PROFILING)
@@ -324,6 +397,9 @@ usage_text[] = {
 "  -h       Heap residency profile (output file <program>.hp)",
 #endif
 "  -i<sec>  Time between heap profile samples (seconds, default: 0.1)",
+"  --info-table-samples",
+"           Sample what the program evaluates on every tick, by info",
+"           table (output file <program>.itprof, and the eventlog)",
 "",
 #if defined(TICKY_TICKY)
 "  -r<file>  Produce ticky-ticky statistics (with -rstderr for stderr)",
@@ -374,8 +450,11 @@ usage_text[] = {
 #endif
 "  --install-signal-handlers=<yes|no>",
 "            Install signal handlers (default: yes)",
+"  --perf-map",
+"            Write the symbols of code loaded by the linker (GHCi) to",
+"            /tmp/perf-<pid>.map, for the Linux perf tools",
 #if defined(THREADED_RTS)
-"  -e<n>     Maximum number of outstanding local sparks (default: 4096)",
+"  -e<n>     Initial size of the local spark pool (default: 4096)",
 #endif
 #if defined(x86_64_HOST_ARCH)
 "  -xm       Base address to mmap memory in the GHCi linker",
@@ -408,7 +487,13 @@ usage_text[] = {
 #ifdef USE_PERF_EVENT
 #ifdef TRACING
 "  -E        CPU performance counter measurements using perf_events",
+"  -Eg       As -E, also sampling instructions, cache misses and branch",
+"            misses with each instruction pointer",
 #endif
+"  -Ep       Count cache and TLB misses in each phase of the GC, per GC",
+"            thread (reported by -s, and in the eventlog with -lg)",
+"  -Et       Count cycles, instructions and cache misses per Haskell",
+"            thread (in the eventlog with -ls)",
 #endif
 "",
 "RTS options may also be specified using the GHCRTS environment variable.",
@@ -425,6 +510,12 @@ strequal(const char *a, const char * b)
     return(strcmp(a, b) == 0);
 }
 
+STATIC_INLINE rtsBool
+strprefix(const char *a, const char * prefix)
+{
+    return(strncmp(a, prefix, strlen(prefix)) == 0);
+}
+
 static void splitRtsFlags(const char *s)
 {
     const char *c1, *c2;
@@ -693,12 +784,153 @@ error = rtsTrue;
                       OPTION_UNSAFE;
                       RtsFlags.MiscFlags.machineReadable = rtsTrue;
                   }
+                  else if (strequal("perf-map",
+                               &rts_argv[arg][2])) {
+                      OPTION_UNSAFE;
+                      RtsFlags.MiscFlags.perfMap = rtsTrue;
+                  }
+                  else if (strequal("info-table-samples",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      RtsFlags.ProfFlags.infoTableSamples = rtsTrue;
+                  }
                   else if (strequal("info",
                                &rts_argv[arg][2])) {
                       OPTION_SAFE;
                       printRtsInfo();
                       stg_exit(0);
                   }
+                  else if (strequal("eventlog-async",
+                               &rts_argv[arg][2]) ||
+                           strprefix(&rts_argv[arg][2],
+                               "eventlog-async=")) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(THREADED_BUILD_ONLY(
+                          RtsFlags.TraceFlags.asyncWriter = rtsTrue;
+                          if (rts_argv[arg][16] == '=') {
+                              int n = atoi(rts_argv[arg]+17);
+                              if (n < 1) {
+                                  bad_option(rts_argv[arg]);
+                              }
+                              RtsFlags.TraceFlags.asyncBuffers = n;
+                          }
+                      ));
+                  }
+                  else if (strequal("eventlog-compact",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.compact = rtsTrue;
+                      );
+                  }
+                  else if (strequal("eventlog-tsc",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.tsc = rtsTrue;
+                      );
+                  }
+                  else if (strequal("eventlog-index",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.index = rtsTrue;
+                      );
+                  }
+                  else if (strequal("eventlog-stack-sample",
+                               &rts_argv[arg][2]) ||
+                           strprefix(&rts_argv[arg][2],
+                               "eventlog-stack-sample=")) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.stackSampleDepth = 32;
+                          if (rts_argv[arg][23] == '=') {
+                              int n = atoi(rts_argv[arg]+24);
+                              if (n < 1) {
+                                  bad_option(rts_argv[arg]);
+                              }
+                              RtsFlags.TraceFlags.stackSampleDepth = n;
+                          }
+                      );
+                  }
+#ifdef USE_DWARF
+                  else if (strequal("eventlog-symbolize",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.symbolize = rtsTrue;
+                      );
+                  }
+                  else if (strprefix(&rts_argv[arg][2],
+                               "eventlog-dwarf-cache=")) {
+                      OPTION_UNSAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.dwarfCache = rts_argv[arg]+23;
+                      );
+                  }
+                  else if (strequal("eventlog-dwarf-async",
+                               &rts_argv[arg][2])) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(THREADED_BUILD_ONLY(
+                          RtsFlags.TraceFlags.dwarfAsync = rtsTrue;
+                      ));
+                  }
+#endif
+                  else if (strprefix(&rts_argv[arg][2],
+                               "eventlog-rotate-size=")) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.rotateSize =
+                              decodeSize(rts_argv[arg], 23,
+                                         1024 * 1024, HS_WORD_MAX);
+                      );
+                  }
+                  else if (strprefix(&rts_argv[arg][2],
+                               "eventlog-rotate-time=")) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.rotateTime =
+                              fsecondsToTime(atof(rts_argv[arg]+23));
+                          if (RtsFlags.TraceFlags.rotateTime <= 0) {
+                              bad_option(rts_argv[arg]);
+                          }
+                      );
+                  }
+                  else if (strprefix(&rts_argv[arg][2],
+                               "eventlog-ring=")) {
+                      OPTION_SAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.ringSize =
+                              decodeSize(rts_argv[arg], 16,
+                                         512 * 1024, HS_WORD_MAX);
+                      );
+                  }
+#if !defined(mingw32_HOST_OS)
+                  else if (strprefix(&rts_argv[arg][2], "eventlog-fd=")) {
+                      OPTION_UNSAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.sink = EVENTLOG_SINK_FD;
+                          RtsFlags.TraceFlags.sinkFd = atoi(rts_argv[arg]+14);
+                          if (RtsFlags.TraceFlags.sinkFd < 0) {
+                              bad_option(rts_argv[arg]);
+                          }
+                      );
+                  }
+                  else if (strprefix(&rts_argv[arg][2], "eventlog-pipe=")) {
+                      OPTION_UNSAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.sink = EVENTLOG_SINK_PIPE;
+                          RtsFlags.TraceFlags.sinkPath = rts_argv[arg]+16;
+                      );
+                  }
+                  else if (strprefix(&rts_argv[arg][2], "eventlog-socket=")) {
+                      OPTION_UNSAFE;
+                      TRACING_BUILD_ONLY(
+                          RtsFlags.TraceFlags.sink = EVENTLOG_SINK_SOCKET;
+                          RtsFlags.TraceFlags.sinkPath = rts_argv[arg]+18;
+                      );
+                  }
+#endif
                   else {
 		      OPTION_SAFE;
 		      errorBelch("unknown RTS option: %s",rts_argv[arg]);
@@ -771,12 +1003,27 @@ error = rtsTrue;
 #endif
 
 #ifdef USE_PERF_EVENT
-#ifdef TRACING
 			case 'E':
 				OPTION_UNSAFE;
-				RtsFlags.PerfEventFlags.sampleType = 1;
-				break;
+				switch(rts_argv[arg][2]) {
+#ifdef TRACING
+				case '\0':
+					RtsFlags.PerfEventFlags.sampleType = PERF_EVENT_SAMPLE_IP;
+					break;
+				case 'g':
+					RtsFlags.PerfEventFlags.sampleType = PERF_EVENT_SAMPLE_GROUP;
+					break;
 #endif
+				case 'p':
+					RtsFlags.PerfEventFlags.gcPhases = rtsTrue;
+					break;
+				case 't':
+					RtsFlags.PerfEventFlags.threadCounters = rtsTrue;
+					break;
+				default:
+					bad_option( rts_argv[arg] );
+				}
+				break;
 #endif
 
 	      case 'B':
@@ -35,6 +35,7 @@
 #include "Profiling.h"
 #include "Timer.h"
 #include "Globals.h"
+#include "InfoTableProf.h"
 void exitLinker( void );	// there is no Linker.h file to include
 
 #if defined(RTS_GTK_FRONTPANEL)
@@ -62,6 +63,10 @@ void exitLinker( void );	// there is no Linker.h file to include
 #include <locale.h>
 #endif
 
+#ifdef USE_PERF_EVENT
+#include "PerfEvent.h"
+#endif
+
 #if USE_PAPI
 #include "Papi.h"
 #endif
@@ -162,6 +167,11 @@ hs_init_ghc(int *argc, char **argv[], RtsConfig rts_config)
 #ifdef TRACING
     initTracing();
 #endif
+
+#ifdef USE_PERF_EVENT
+    /* before any tasks, which register with the sample reader */
+    perf_event_start_reader();
+#endif
     /* Trace the startup event
      */
     traceEventStartup();
@@ -251,9 +261,7 @@ hs_init_ghc(int *argc, char **argv[], RtsConfig rts_config)
 #ifdef TRACING
   // If tracing is active, load then write out debuging information
   if (RtsFlags.TraceFlags.tracing) {
-      dwarf_load();
-      dwarf_trace_debug_data();
-      dwarf_free();
+      dwarf_init_tracing();
   }
 #endif
 #endif
@@ -353,6 +361,12 @@ hs_exit_(rtsBool wait_foreign)
     stopTimer();
     exitTimer(wait_foreign);
 
+#ifdef USE_PERF_EVENT
+    /* read the perf_event samples that are left, while the tasks and
+     * the eventlog are still there */
+    perf_event_stop_reader();
+#endif
+
     // set the terminal settings back to what they were
 #if !defined(mingw32_HOST_OS)    
     resetTerminalSettings();
@@ -405,6 +419,7 @@ hs_exit_(rtsBool wait_foreign)
 
     endProfiling();
     freeProfiling();
+    endInfoTableProfiling();
 
 #ifdef PROFILING
     // Originally, this was in report_ccs_profiling().  Now, retainer
@@ -414,6 +429,12 @@ hs_exit_(rtsBool wait_foreign)
 #endif
 
 #ifdef TRACING
+#ifdef USE_DWARF
+    // post the IP samples counted per procedure (--eventlog-symbolize)
+    if (RtsFlags.TraceFlags.tracing) {
+        dwarf_exit_tracing();
+    }
+#endif
     endTracing();
     freeTracing();
 #endif
@@ -60,6 +60,13 @@
 #ifdef TRACING
 #include "eventlog/EventLog.h"
 #endif
+
+#include "PerfEvent.h"
+#include "InfoTableProf.h"
+
+#ifdef USE_DWARF
+#include "Dwarf.h"
+#endif
 /* -----------------------------------------------------------------------------
  * Global variables
  * -------------------------------------------------------------------------- */
@@ -449,6 +456,7 @@ run_thread:
 #endif
 
     traceEventRunThread(cap, t);
+    perf_event_run_thread(task);
 
     switch (prev_what_next) {
 	
@@ -502,6 +510,12 @@ run_thread:
     } else {
         traceEventStopThread(cap, t, ret, 0);
     }
+    perf_event_stop_thread(cap, task, t);
+
+    if (ret != ThreadFinished) {
+        traceStackSample(cap, t);
+        sampleInfoTable(cap, t);
+    }
 
     ASSERT_FULL_CAPABILITY_INVARIANTS(cap,task);
     ASSERT(t->cap == cap);
@@ -610,6 +624,13 @@ scheduleFindWork (Capability *cap)
     scheduleCheckBlockedThreads(cap);
 
 #if defined(THREADED_RTS)
+    // Threads we exported stay there while another Capability is free
+    // to steal them; otherwise we run them ourselves.
+    if (!looksEmptyWSDeque(cap->exported_threads) &&
+        (emptyRunQueue(cap) || !wakeupIdleCapability(cap))) {
+        reclaimExportedThreads(cap);
+    }
+    if (emptyRunQueue(cap)) { findThread(cap); }
     if (emptyRunQueue(cap)) { scheduleActivateSpark(cap); }
 #endif
 }
@@ -1497,6 +1518,15 @@ scheduleDoGC (Capability *cap, Task *task USED_IF_THREADS, rtsBool force_major)
     IF_DEBUG(scheduler, printAllThreads());
 
 delete_threads_and_gc:
+#if defined(THREADED_RTS)
+    // Nobody can steal threads now, so put the ones still waiting to be
+    // stolen back on their run queues, where the GC expects them.
+    for (i = 0; i < n_capabilities; i++) {
+        reclaimExportedThreads(&capabilities[i]);
+        freeRetiredWSDeque(capabilities[i].exported_threads);
+    }
+#endif
+
     /*
      * We now have all the capabilities; if we're in an interrupting
      * state, then we should take the opportunity to delete all the
@@ -1556,6 +1586,12 @@ delete_threads_and_gc:
     ASSERT(checkSparkCountInvariant());
 #endif
 
+#if defined(TRACING)
+    // No capability is running: write out the eventlog flight recorder
+    // if we have been asked to.
+    dumpRequestedEventLog();
+#endif
+
     // The heap census itself is done during GarbageCollect().
     if (heap_census) {
         performHeapProfile = rtsFalse;
@@ -1698,6 +1734,24 @@ forkProcess(HsStablePtr *entry
         resetTracing();
 #endif
 
+#ifdef USE_PERF_EVENT
+        perf_event_fork_child();
+#endif
+
+#if defined(USE_DWARF) && defined(TRACING)
+        if (RtsFlags.TraceFlags.tracing) {
+            dwarf_fork_child();
+        }
+#endif
+
+#if defined(THREADED_RTS)
+        // Threads waiting to be stolen are deleted with the others,
+        // from the run queues
+        for (i=0; i < n_capabilities; i++) {
+            reclaimExportedThreads(&capabilities[i]);
+        }
+#endif
+
         // Now, all OS threads except the thread that forked are
 	// stopped.  We need to stop all Haskell threads, including
 	// those involved in foreign calls.  Also we need to delete
@@ -1996,6 +2050,7 @@ suspendThread (StgRegTable *reg, rtsBool interruptible)
   tso = cap->r.rCurrentTSO;
 
   traceEventStopThread(cap, tso, THREAD_SUSPENDED_FOREIGN_CALL, 0);
+  perf_event_stop_thread(cap, task, tso);
 
   // XXX this might not be necessary --SDM
   tso->what_next = ThreadRunGHC;
@@ -2063,6 +2118,7 @@ resumeThread (void *task_)
     tso->_link = END_TSO_QUEUE; // no write barrier reqd
 
     traceEventRunThread(cap, tso);
+    perf_event_run_thread(task);
     
     /* Reset blocking status */
     tso->why_blocked  = NotBlocked;
@@ -2103,6 +2159,16 @@ resumeThread (void *task_)
 void
 scheduleThread(Capability *cap, StgTSO *tso)
 {
+#if defined(THREADED_RTS)
+    // Let a free Capability steal it, if there is one (migration can be
+    // turned off with +RTS -qm)
+    if (n_capabilities > 1 && RtsFlags.ParFlags.migrate &&
+        sched_state == SCHED_RUNNING &&
+        tso->bound == NULL && !tsoLocked(tso)) {
+        exportThread(cap,tso);
+        return;
+    }
+#endif
     // The thread goes at the *end* of the run-queue, to avoid possible
     // starvation of any threads already on the queue.
     appendToRunQueue(cap,tso);
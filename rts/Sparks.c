@@ -60,14 +60,9 @@ newSpark (StgRegTable *reg, StgClosure *p)
     SparkPool *pool = cap->sparks;
 
     if (!fizzledSpark(p)) {
-        if (pushWSDeque(pool,p)) {
-            cap->spark_stats.created++;
-            traceEventSparkCreate(cap);
-        } else {
-            /* overflowing the spark pool */
-            cap->spark_stats.overflowed++;
-            traceEventSparkOverflow(cap);
-	}
+        pushWSDeque(pool,p);
+        cap->spark_stats.created++;
+        traceEventSparkCreate(cap);
     } else {
         cap->spark_stats.dud++;
         traceEventSparkDud(cap);
@@ -96,6 +91,10 @@ pruneSparkQueue (Capability *cap)
     pruned_sparks = 0;
     
     pool = cap->sparks;
+
+    // no stealing is happening during GC, so the arrays the pool has
+    // grown out of can go
+    freeRetiredWSDeque(pool);
     
     // it is possible that top > bottom, indicating an empty pool.  We
     // fix that here; this is only necessary because the loop below
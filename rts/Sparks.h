@@ -19,7 +19,6 @@
 typedef struct {
     StgWord created;
     StgWord dud;
-    StgWord overflowed;
     StgWord converted;
     StgWord gcd;
     StgWord fizzled;
@@ -41,6 +40,7 @@ INLINE_HEADER StgClosure* reclaimSpark(SparkPool *pool);
 INLINE_HEADER rtsBool looksEmpty(SparkPool* deque);
 
 INLINE_HEADER StgClosure * tryStealSpark (SparkPool *pool);
+INLINE_HEADER StgClosure * tryStealSparks (SparkPool *pool, SparkPool *into);
 INLINE_HEADER rtsBool      fizzledSpark  (StgClosure *);
 
 void         freeSparkPool     (SparkPool *pool);
@@ -96,6 +96,19 @@ INLINE_HEADER StgClosure * tryStealSpark (SparkPool *pool)
     // other pools before trying again.
 }
 
+/* ----------------------------------------------------------------------------
+ *
+ * tryStealSparks: like tryStealSpark, but takes up to half of the
+ * sparks in the pool in one go, and moves all but the one it returns
+ * into our own pool.
+ *
+ -------------------------------------------------------------------------- */
+
+INLINE_HEADER StgClosure * tryStealSparks (SparkPool *pool, SparkPool *into)
+{
+    return stealHalfWSDeque_(pool, into);
+}
+
 INLINE_HEADER rtsBool fizzledSpark (StgClosure *spark)
 {
     return (GET_CLOSURE_TAG(spark) != 0 || !closure_SHOULD_SPARK(spark));
@@ -18,6 +18,7 @@
 #include "sm/GC.h" // gc_alloc_block_sync, whitehole_spin
 #include "sm/GCThread.h"
 #include "sm/BlockAlloc.h"
+#include "Trace.h"
 
 #if USE_PAPI
 #include "Papi.h"
@@ -27,6 +28,10 @@
 #include "PerfEvent.h"
 #endif
 
+#ifdef TRACING
+#include "eventlog/EventLog.h"
+#endif
+
 /* huh? */
 #define BIG_STRING_LEN              512
 
@@ -330,6 +335,75 @@ stat_gcWorkerThreadDone (gc_thread *gct)
     }
 }
 
+/* -----------------------------------------------------------------------------
+   Live data in a generation, including the pinned object blocks and the
+   GC threads' workspaces
+   -------------------------------------------------------------------------- */
+
+static void
+genTotalLive (nat g, lnat *live, lnat *blocks)
+{
+    generation *gen = &generations[g];
+    bdescr *bd;
+    nat i;
+
+    *live   = genLiveWords(gen);
+    *blocks = genLiveBlocks(gen);
+
+    for (i = 0; i < n_capabilities; i++) {
+        // Add the pinned object block.
+        bd = capabilities[i].pinned_object_block;
+        if (bd != NULL) {
+            *live   += bd->free - bd->start;
+            *blocks += bd->blocks;
+        }
+
+        *live   += gcThreadLiveWords(i,g);
+        *blocks += gcThreadLiveBlocks(i,g);
+    }
+}
+
+/* -----------------------------------------------------------------------------
+   Post the details of a GC to the eventlog
+   -------------------------------------------------------------------------- */
+
+#ifdef TRACING
+static void
+traceGcDetails (gc_thread *gct,
+                lnat alloc, lnat live, lnat copied, nat gen,
+                lnat max_copied, lnat avg_copied, lnat slop)
+{
+    nat g, i;
+    lnat gen_live, gen_blocks;
+    gc_thread *t;
+
+    traceGcStats_(gct->cap, gen,
+                  alloc * sizeof(W_), copied * sizeof(W_),
+                  live * sizeof(W_), slop * sizeof(W_),
+                  n_gc_threads,
+                  max_copied * sizeof(W_), avg_copied * sizeof(W_));
+
+    for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+        genTotalLive(g, &gen_live, &gen_blocks);
+        traceGcGenStats_(gct->cap, g,
+                         gen_blocks * BLOCK_SIZE,
+                         gen_live * sizeof(W_),
+                         (gen_blocks * BLOCK_SIZE_W - gen_live) * sizeof(W_),
+                         generations[g].n_large_blocks * BLOCK_SIZE);
+    }
+
+    if (n_gc_threads > 1) {
+        for (i = 0; i < n_gc_threads; i++) {
+            t = gc_threads[i];
+            traceGcThreadStats_(gct->cap, i,
+                                t->copied * sizeof(W_),
+                                t->scanned * sizeof(W_),
+                                t->any_work, t->no_work, t->scav_find_work);
+        }
+    }
+}
+#endif
+
 /* -----------------------------------------------------------------------------
    Called at the end of each GC
    -------------------------------------------------------------------------- */
@@ -397,6 +471,13 @@ stat_endGC (gc_thread *gct,
         if (slop > max_slop) max_slop = slop;
     }
 
+#ifdef TRACING
+    if (RTS_UNLIKELY(TRACE_gc)) {
+        traceGcDetails(gct, alloc, live, copied, gen,
+                       max_copied, avg_copied, slop);
+    }
+#endif
+
     if (rub_bell) {
 	debugBelch("\b\b\b  \b\b\b");
 	rub_bell = 0;
@@ -670,21 +751,30 @@ stat_exit(int alloc)
 
             {
                 nat i;
-                SparkCounters sparks = { 0, 0, 0, 0, 0, 0};
+                SparkCounters sparks = { 0, 0, 0, 0, 0};
                 for (i = 0; i < n_capabilities; i++) {
                     sparks.created   += capabilities[i].spark_stats.created;
                     sparks.dud       += capabilities[i].spark_stats.dud;
-                    sparks.overflowed+= capabilities[i].spark_stats.overflowed;
                     sparks.converted += capabilities[i].spark_stats.converted;
                     sparks.gcd       += capabilities[i].spark_stats.gcd;
                     sparks.fizzled   += capabilities[i].spark_stats.fizzled;
                 }
 
-                statsPrintf("  SPARKS: %ld (%ld converted, %ld overflowed, %ld dud, %ld GC'd, %ld fizzled)\n\n",
-                            sparks.created + sparks.dud + sparks.overflowed,
-                            sparks.converted, sparks.overflowed, sparks.dud,
+                statsPrintf("  SPARKS: %ld (%ld converted, %ld dud, %ld GC'd, %ld fizzled)\n\n",
+                            sparks.created + sparks.dud,
+                            sparks.converted, sparks.dud,
                             sparks.gcd, sparks.fizzled);
             }
+
+#if defined(TRACING)
+            if (RtsFlags.TraceFlags.asyncWriter) {
+                StgWord64 written, blocked, dropped;
+                getEventLogWriterStats(&written, &blocked, &dropped);
+                statsPrintf("  EVENTLOG: %" FMT_Word64 " buffers written "
+                            "(%" FMT_Word64 " blocked, %" FMT_Word64 " dropped)\n\n",
+                            written, blocked, dropped);
+            }
+#endif
 #endif
 
 	    statsPrintf("  INIT    time  %6.2fs  (%6.2fs elapsed)\n",
@@ -746,6 +836,9 @@ stat_exit(int alloc)
 			}
 		}
 #endif
+#ifdef USE_PERF_EVENT
+            perf_event_gc_stats_report();
+#endif
 #if defined(THREADED_RTS) && defined(PROF_SPIN)
             {
                 nat g;
@@ -843,22 +936,11 @@ statDescribeGens(void)
           lge++;
       }
 
-      gen_live   = genLiveWords(gen);
-      gen_blocks = genLiveBlocks(gen);
+      genTotalLive(g, &gen_live, &gen_blocks);
 
       mut = 0;
       for (i = 0; i < n_capabilities; i++) {
           mut += countOccupied(capabilities[i].mut_lists[g]);
-
-          // Add the pinned object block.
-          bd = capabilities[i].pinned_object_block;
-          if (bd != NULL) {
-              gen_live   += bd->free - bd->start;
-              gen_blocks += bd->blocks;
-          }
-
-          gen_live   += gcThreadLiveWords(i,g);
-          gen_blocks += gcThreadLiveBlocks(i,g);
       }
 
       debugBelch("%5d %7ld %9d", g, (lnat)gen->max_blocks, mut);
@@ -936,14 +1018,12 @@ extern void getSparkStats( SparkCounters *s ) {
     nat i;
     s->created = 0;
     s->dud = 0;
-    s->overflowed = 0;
     s->converted = 0;
     s->gcd = 0;
     s->fizzled = 0;
     for (i = 0; i < n_capabilities; i++) {
         s->created   += capabilities[i].spark_stats.created;
         s->dud       += capabilities[i].spark_stats.dud;
-        s->overflowed+= capabilities[i].spark_stats.overflowed;
         s->converted += capabilities[i].spark_stats.converted;
         s->gcd       += capabilities[i].spark_stats.gcd;
         s->fizzled   += capabilities[i].spark_stats.fizzled;
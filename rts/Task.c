@@ -156,6 +156,9 @@ freeTask (Task *task)
     closeCondition(&task->cond);
     closeMutex(&task->lock);
 #endif
+#if defined(USE_PERF_EVENT)
+    perf_event_free_task(task);
+#endif
 
     for (incall = task->incall; incall != NULL; incall = next) {
         next = incall->prev_stack;
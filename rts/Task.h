@@ -184,12 +184,30 @@ typedef struct Task_ {
 #endif
 
 #ifdef USE_PERF_EVENT
+#define PERF_EVENT_THREAD_COUNTERS 3
 	int perf_event_fd;
 	union {
 		void *perf_event_mmap;
 		struct perf_event_mmap_page *perf_event_data;
 	};
 	StgWord64 perf_event_last_head;
+	// counters read with each sample (-Eg), see EVENT_PERF_SAMPLE.
+	// Each group keeps the fds of its members other than the leader,
+	// or -1.
+#define PERF_EVENT_MAX_MEMBERS 3
+	StgWord16 perf_event_counters;
+	nat perf_event_n_counters;
+	int perf_event_member_fds[PERF_EVENT_MAX_MEMBERS];
+	// counting cache and TLB misses for the GC phases (-Ep)
+	int perf_event_gc_fd;
+	int perf_event_gc_member_fds[PERF_EVENT_MAX_MEMBERS];
+	StgWord16 perf_event_gc_counters;
+	// counting for the Haskell thread we run (-Et): cycles,
+	// instructions and cache misses when it started running
+	int perf_event_thread_fd;
+	int perf_event_thread_member_fds[PERF_EVENT_MAX_MEMBERS];
+	StgWord16 perf_event_thread_counters;
+	StgWord64 perf_event_thread_start[PERF_EVENT_THREAD_COUNTERS];
 #endif
 
 } Task;
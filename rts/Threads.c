@@ -115,6 +115,10 @@ createThread(Capability *cap, nat size)
 #ifdef PROFILING
     tso->prof.CCCS = CCS_MAIN;
 #endif
+
+    tso->perf_cycles = 0;
+    tso->perf_instructions = 0;
+    tso->perf_cache_misses = 0;
     
     // put a stop frame on the stack
     stack->sp -= sizeofW(StgStopFrame);
@@ -164,6 +168,29 @@ rts_getThreadId(StgPtr tso)
   return ((StgTSO *)tso)->id;
 }
 
+/* ---------------------------------------------------------------------------
+ * Fetching the hardware counters of a thread (+RTS -Et).
+ *
+ * The counts are updated whenever the thread stops running, so they
+ * leave out what the thread is doing right now.
+ * ------------------------------------------------------------------------ */
+HsBool
+rts_getThreadCounters(StgPtr tso,
+                      HsWord64 *cycles, HsWord64 *instructions,
+                      HsWord64 *cache_misses)
+{
+#ifdef USE_PERF_EVENT
+  if (RtsFlags.PerfEventFlags.threadCounters) {
+      *cycles       = ((StgTSO *)tso)->perf_cycles;
+      *instructions = ((StgTSO *)tso)->perf_instructions;
+      *cache_misses = ((StgTSO *)tso)->perf_cache_misses;
+      return HS_BOOL_TRUE;
+  }
+#endif
+  *cycles = *instructions = *cache_misses = 0;
+  return HS_BOOL_FALSE;
+}
+
 /* -----------------------------------------------------------------------------
    Remove a thread from a queue.
    Fails fatally if the TSO is not on the queue.
@@ -282,9 +309,17 @@ tryWakeupThread (Capability *cap, StgTSO *tso)
         goto unblock;
     }
 
+    case ThreadMigrating:
+#if defined(THREADED_RTS)
+        if (tso->flags & TSO_EXPORTED) {
+            // runnable already, waiting to be stolen (exportThread())
+            return;
+        }
+#endif
+        goto unblock;
+
     case BlockedOnBlackHole:
     case BlockedOnSTM:
-    case ThreadMigrating:
         goto unblock;
 
     default:
@@ -347,6 +382,7 @@ wakeBlockingQueue(Capability *cap, StgBlockingQueue *bq)
         i = msg->header.info;
         if (i != &stg_IND_info) {
             ASSERT(i == &stg_MSG_BLACKHOLE_info);
+            traceThreadUnblocked(cap, msg->tso, bq->bh, bq->owner);
             tryWakeupThread(cap,msg->tso);
         }
     }
@@ -86,17 +86,29 @@ handle_tick(int unused STG_UNUSED)
   }
 #endif
 
+  if (RtsFlags.ProfFlags.infoTableSamples) {
+      nat n;
+      for (n = 0; n < n_capabilities; n++) {
+          capabilities[n].sample_info = 1;
+          stopCapability(&capabilities[n]);
+      }
+  }
+
 #ifdef TRACING
+  if (RtsFlags.TraceFlags.stackSampleDepth > 0) {
+      nat n;
+      // Make the running threads return to the scheduler, which samples
+      // their stacks; they are not descheduled.
+      for (n = 0; n < n_capabilities; n++) {
+          capabilities[n].sample_stack = 1;
+          stopCapability(&capabilities[n]);
+      }
+  }
 #ifdef USE_PAPI
   if(RtsFlags.PapiFlags.sampleType) {
 	  papi_timer();
   }
 #endif
-#ifdef USE_PERF_EVENTS
-  if(RtsFlags.PerfEventFlags.sampleType) {
-	  papi_timer();
-  }
-#endif
 #endif
 
 }
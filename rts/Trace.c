@@ -20,6 +20,7 @@
 #include "eventlog/EventLog.h"
 #include "Threads.h"
 #include "Printer.h"
+#include "Dwarf.h"
 
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -150,6 +151,42 @@ void tracingAddCapapilities (nat from, nat to)
     }
 }
 
+/* ---------------------------------------------------------------------------
+   Switching event classes on and off while the program runs
+
+   The TRACE_* flags are plain ints tested by the macros in Trace.h, so
+   changing them costs nothing on the hot path.  Classes can only be
+   switched on if tracing was enabled at startup (+RTS -l or -v), as
+   otherwise there is nowhere to send the events.
+ --------------------------------------------------------------------------- */
+
+StgWord setTraceClasses (StgWord on, StgWord off)
+{
+    StgWord old;
+
+#define TRACE_CLASS(bit, class)                 \
+    if (class) { old |= bit; }                  \
+    if (on & bit) { class = 1; }                \
+    if (off & bit) { class = 0; }
+
+    if (RtsFlags.TraceFlags.tracing == TRACE_NONE) {
+        return 0;
+    }
+
+    ACQUIRE_LOCK(&trace_utx);
+    old = 0;
+    TRACE_CLASS(RTS_TRACE_SCHEDULER,      TRACE_sched);
+    TRACE_CLASS(RTS_TRACE_GC,             TRACE_gc);
+    TRACE_CLASS(RTS_TRACE_SPARKS_SAMPLED, TRACE_spark_sampled);
+    TRACE_CLASS(RTS_TRACE_SPARKS_FULL,    TRACE_spark_full);
+    TRACE_CLASS(RTS_TRACE_USER,           TRACE_user);
+    RELEASE_LOCK(&trace_utx);
+
+#undef TRACE_CLASS
+
+    return old;
+}
+
 /* ---------------------------------------------------------------------------
    Emitting trace messages/events
  --------------------------------------------------------------------------- */
@@ -466,6 +503,136 @@ void traceSparkCounters_ (Capability *cap,
     }
 }
 
+/* The GC statistics aren't traced to stderr: see +RTS -S instead. */
+
+void traceGcStats_ (Capability *cap, nat gen,
+                    lnat alloc, lnat copied, lnat live, lnat slop,
+                    nat par_n_threads, lnat par_max_copied,
+                    lnat par_tot_copied)
+{
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+    } else
+#endif
+    {
+        postGcStatsEvent(cap, gen, alloc, copied, live, slop,
+                         par_n_threads, par_max_copied, par_tot_copied);
+    }
+}
+
+void traceGcGenStats_ (Capability *cap, nat gen,
+                       lnat size, lnat live, lnat slop, lnat large)
+{
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+    } else
+#endif
+    {
+        postGcGenStatsEvent(cap, gen, size, live, slop, large);
+    }
+}
+
+void traceGcThreadStats_ (Capability *cap, nat gc_thread,
+                          lnat copied, lnat scanned, lnat any_work,
+                          lnat no_work, lnat scav_find_work)
+{
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+    } else
+#endif
+    {
+        postGcThreadStatsEvent(cap, gc_thread, copied, scanned,
+                               any_work, no_work, scav_find_work);
+    }
+}
+
+void traceGcPhaseCounters_ (Capability *cap, nat gc_thread, nat phase,
+                            StgWord64 cache_misses, StgWord64 dtlb_misses)
+{
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+    } else
+#endif
+    {
+        postGcPhaseCountersEvent(cap, gc_thread, phase,
+                                 cache_misses, dtlb_misses);
+    }
+}
+
+void traceThreadCounters_ (Capability *cap, StgTSO *tso,
+                           StgWord64 cycles, StgWord64 instructions,
+                           StgWord64 cache_misses)
+{
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        ACQUIRE_LOCK(&trace_utx);
+        tracePreface();
+        debugBelch("cap %d: thread %lu counted %" FMT_Word64 " cycles, "
+                   "%" FMT_Word64 " instructions, %" FMT_Word64
+                   " cache misses\n", cap->no, (lnat)tso->id,
+                   cycles, instructions, cache_misses);
+        RELEASE_LOCK(&trace_utx);
+    } else
+#endif
+    {
+        postThreadCountersEvent(cap, (EventThreadID)tso->id, cycles,
+                                instructions, cache_misses);
+    }
+}
+
+void traceThreadBlocked (Capability *cap, StgTSO *tso, StgWord reason,
+                         StgClosure *obj, StgTSO *owner)
+{
+    if (!TRACE_sched) {
+        return;
+    }
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        ACQUIRE_LOCK(&trace_utx);
+        tracePreface();
+        debugBelch("cap %d: thread %lu blocked on %s %p",
+                   cap->no, (lnat)tso->id,
+                   reason == BlockedOnMVar ? "MVar" : "black hole", obj);
+        if (owner != NULL) {
+            debugBelch(" owned by thread %lu", (lnat)owner->id);
+        }
+        debugBelch("\n");
+        RELEASE_LOCK(&trace_utx);
+    } else
+#endif
+    {
+        postThreadBlockedEvent(cap, tso->id, reason, (StgWord64)(W_)obj,
+                               owner != NULL ? owner->id : 0,
+                               tso->cap->no);
+    }
+}
+
+void traceThreadUnblocked (Capability *cap, StgTSO *tso,
+                           StgClosure *obj, StgTSO *waker)
+{
+    if (!TRACE_sched) {
+        return;
+    }
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        ACQUIRE_LOCK(&trace_utx);
+        tracePreface();
+        debugBelch("cap %d: thread %lu unblocked from %p",
+                   cap->no, (lnat)tso->id, obj);
+        if (waker != NULL) {
+            debugBelch(" by thread %lu", (lnat)waker->id);
+        }
+        debugBelch("\n");
+        RELEASE_LOCK(&trace_utx);
+    } else
+#endif
+    {
+        postThreadUnblockedEvent(cap, tso->id, (StgWord64)(W_)obj,
+                                 waker != NULL ? waker->id : 0,
+                                 tso->cap->no);
+    }
+}
+
 #ifdef DEBUG
 static void traceCap_stderr(Capability *cap, char *msg, va_list ap)
 {
@@ -568,6 +735,75 @@ void traceModule(char *modName,
 	}
 }
 
+// Frames of a stack sample (+RTS --eventlog-stack-sample) at most
+#define MAX_STACK_SAMPLE_DEPTH 256
+
+void traceStackSample_ (Capability *cap, StgTSO *tso)
+{
+    StgWord64 frames[MAX_STACK_SAMPLE_DEPTH];
+    StgStack *stack;
+    StgPtr sp, stack_end;
+    const StgRetInfoTable *info;
+    nat depth, n;
+
+    cap->sample_stack = 0;
+
+    depth = RtsFlags.TraceFlags.stackSampleDepth;
+    if (depth > MAX_STACK_SAMPLE_DEPTH) {
+        depth = MAX_STACK_SAMPLE_DEPTH;
+    }
+
+    // Walk the frames like printStackChunk does, following underflow
+    // frames into the older stack chunks
+    stack = tso->stackobj;
+    sp = stack->sp;
+    stack_end = stack->stack + stack->stack_size;
+    for (n = 0; n < depth && sp < stack_end; ) {
+        info = get_ret_itbl((StgClosure *)sp);
+        switch (info->i.type) {
+        case UNDERFLOW_FRAME:
+            stack = ((StgUnderflowFrame *)sp)->next_chunk;
+            sp = stack->sp;
+            stack_end = stack->stack + stack->stack_size;
+            continue;
+        case STOP_FRAME:
+            sp = stack_end;
+            continue;
+        default:
+            frames[n++] = (StgWord64)(W_)((StgClosure *)sp)->header.info;
+            sp += stack_frame_sizeW((StgClosure *)sp);
+        }
+    }
+
+#ifdef DEBUG
+    if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+        nat i;
+        ACQUIRE_LOCK(&trace_utx);
+        tracePreface();
+        debugBelch("cap %d: stack of thread %lu:", cap->no, (lnat)tso->id);
+        for (i = 0; i < n; i++) {
+            debugBelch(" %p", (void *)(W_)frames[i]);
+        }
+        debugBelch("\n");
+        RELEASE_LOCK(&trace_utx);
+    } else
+#endif
+    {
+        if (eventlog_enabled) {
+            postStackSample(cap, tso->id, n, frames);
+        }
+    }
+}
+
+void traceInfoTableSamples (Capability *cap, StgWord32 cnt,
+                            StgWord64 *samples)
+{
+    // On stderr there's the report in <prog>.itprof instead
+    if (eventlog_enabled) {
+        postInfoTableSamples(cap, cnt, samples);
+    }
+}
+
 void traceInstrPtrSample(Capability *cap, StgBool own_cap, StgWord32 cnt, void **ips)
 {
 #ifdef DEBUG
@@ -582,12 +818,44 @@ void traceInstrPtrSample(Capability *cap, StgBool own_cap, StgWord32 cnt, void *
 	} else
 #endif
 	{
+#ifdef USE_DWARF
+        // Only count the samples per procedure, if asked to
+        if (dwarf_count_samples(cnt, ips)) {
+            return;
+        }
+#endif
         if (eventlog_enabled) {
             postInstrPtrSample(cap, own_cap, cnt, ips);
         }
 	}
 }
 
+void tracePerfSample(Capability *cap, StgBool own_cap, StgWord16 counters,
+                     nat n_counters, StgWord32 cnt, StgWord64 *samples)
+{
+#ifdef DEBUG
+	StgWord32 i;
+	nat j;
+	if (RtsFlags.TraceFlags.tracing == TRACE_STDERR) {
+		ACQUIRE_LOCK(&trace_utx);
+		tracePreface();
+		debugBelch("cap %d counter samples (%x):\n", cap->no, counters);
+		for (i = 0; i < cnt; i++) {
+			debugBelch("  %p", (void *)(W_)*samples++);
+			for (j = 0; j < n_counters; j++)
+				debugBelch(" %" FMT_Word64, *samples++);
+			debugBelch("\n");
+		}
+		RELEASE_LOCK(&trace_utx);
+	} else
+#endif
+	{
+        if (eventlog_enabled) {
+            postPerfSample(cap, own_cap, counters, n_counters, cnt, samples);
+        }
+	}
+}
+
 void traceDebugData(EventTypeNum num, StgWord16 size, StgWord8 *dbg)
 {
 	if (eventlog_enabled) {
@@ -614,6 +882,13 @@ void traceProcPtrRange(void *low_pc, void *high_pc)
 	}
 }
 
+void traceProcSamples(StgWord32 cnt, void **procs, StgWord64 *samples)
+{
+	if (eventlog_enabled) {
+		postProcSamples(cnt, procs, samples);
+	}
+}
+
 void traceThreadLabel_(Capability *cap,
                        StgTSO     *tso,
                        char       *label)
@@ -30,6 +30,9 @@ void freeTracing (void);
 void resetTracing (void);
 void tracingAddCapapilities (nat from, nat to);
 
+// Used by rts_setTraceClasses() and setTraceClasses#
+StgWord setTraceClasses (StgWord on, StgWord off);
+
 #endif /* TRACING */
 
 typedef StgWord32 CapsetID;
@@ -62,7 +65,8 @@ extern int DEBUG_squeeze;
 extern int DEBUG_hpc;
 extern int DEBUG_sparks;
 
-// events
+// events (these may be changed while the program runs, see
+// setTraceClasses())
 extern int TRACE_sched;
 extern int TRACE_gc;
 extern int TRACE_spark_sampled;
@@ -167,11 +171,16 @@ void traceModule(char *modName,
 
 void traceInstrPtrSample(Capability *cap, StgBool own_cap, StgWord32 cnt, void **ips);
 
+// Samples of an ip and n_counters counter values each (+RTS -Eg)
+void tracePerfSample(Capability *cap, StgBool own_cap, StgWord16 counters,
+                     nat n_counters, StgWord32 cnt, StgWord64 *samples);
+
 void traceDebugData(EventTypeNum num, StgWord16 size, StgWord8 *dbg);
 
 void traceDebugModule(char *unit_name);
 void traceDebugProc(char *label);
 void traceProcPtrRange(void *low_pc, void *high_pc);
+void traceProcSamples(StgWord32 cnt, void **procs, StgWord64 *samples);
 
 /*
  * An event to record a Haskell thread's label/name
@@ -235,6 +244,63 @@ void traceSparkCounters_ (Capability *cap,
                           SparkCounters counters,
                           StgWord remaining);
 
+/*
+ * GC statistics, posted by stat_endGC() when GC events are traced
+ * (sizes in bytes)
+ */
+void traceGcStats_ (Capability *cap, nat gen,
+                    lnat alloc, lnat copied, lnat live, lnat slop,
+                    nat par_n_threads, lnat par_max_copied,
+                    lnat par_tot_copied);
+
+void traceGcGenStats_ (Capability *cap, nat gen,
+                       lnat size, lnat live, lnat slop, lnat large);
+
+void traceGcThreadStats_ (Capability *cap, nat gc_thread,
+                          lnat copied, lnat scanned, lnat any_work,
+                          lnat no_work, lnat scav_find_work);
+
+void traceGcPhaseCounters_ (Capability *cap, nat gc_thread, nat phase,
+                            StgWord64 cache_misses, StgWord64 dtlb_misses);
+
+/*
+ * The hardware counters of a thread's last run, posted after
+ * EVENT_STOP_THREAD when scheduler events are traced
+ */
+void traceThreadCounters_ (Capability *cap, StgTSO *tso,
+                           StgWord64 cycles, StgWord64 instructions,
+                           StgWord64 cache_misses);
+
+/*
+ * A thread blocking on a black hole or an MVar (reason is BlockedOnBlackHole
+ * or BlockedOnMVar), and being woken up again.  owner and waker may be
+ * NULL.  Like traceUserMsg these are called from Cmm code, so they check
+ * TRACE_sched themselves.
+ */
+void traceThreadBlocked (Capability *cap, StgTSO *tso, StgWord reason,
+                         StgClosure *obj, StgTSO *owner);
+
+void traceThreadUnblocked (Capability *cap, StgTSO *tso,
+                           StgClosure *obj, StgTSO *waker);
+
+/*
+ * Sample the stack of a thread that has just stopped running, if the
+ * timer asked for a sample (+RTS --eventlog-stack-sample)
+ */
+#define traceStackSample(cap, tso)              \
+    if (RTS_UNLIKELY((cap)->sample_stack)) {    \
+        traceStackSample_(cap, tso);            \
+    }
+
+void traceStackSample_ (Capability *cap, StgTSO *tso);
+
+/*
+ * The info tables a capability sampled (+RTS --info-table-samples),
+ * as (info, count) pairs
+ */
+void traceInfoTableSamples (Capability *cap, StgWord32 cnt,
+                            StgWord64 *samples);
+
 #else /* !TRACING */
 
 #define traceSchedEvent(cap, tag, tso, other) /* nothing */
@@ -253,6 +319,20 @@ INLINE_HEADER void traceEventStartup_ (int n_caps STG_UNUSED) {};
 #define traceWallClockTime_() /* nothing */
 #define traceOSProcessInfo_() /* nothing */
 #define traceSparkCounters_(cap, counters, remaining) /* nothing */
+#define traceGcStats_(cap, gen, alloc, copied, live, slop, \
+                      par_n_threads, par_max_copied, par_tot_copied) \
+    /* nothing */
+#define traceGcGenStats_(cap, gen, size, live, slop, large) /* nothing */
+#define traceGcThreadStats_(cap, gc_thread, copied, scanned, any_work, \
+                            no_work, scav_find_work) /* nothing */
+#define traceGcPhaseCounters_(cap, gc_thread, phase, cache_misses, \
+                              dtlb_misses) /* nothing */
+#define traceThreadCounters_(cap, tso, cycles, instructions, \
+                             cache_misses) /* nothing */
+#define traceThreadBlocked(cap, tso, reason, obj, owner) /* nothing */
+#define traceThreadUnblocked(cap, tso, obj, waker) /* nothing */
+#define traceStackSample(cap, tso) /* nothing */
+#define traceInfoTableSamples(cap, cnt, samples) /* nothing */
 
 #endif /* TRACING */
 
@@ -566,7 +646,7 @@ INLINE_HEADER void traceSparkCounters(Capability *cap STG_UNUSED)
     dtraceSparkCounters((EventCapNo)cap->no,
                         cap->spark_stats.created,
                         cap->spark_stats.dud,
-                        cap->spark_stats.overflowed,
+                        0, // overflowed
                         cap->spark_stats.converted,
                         cap->spark_stats.gcd,
                         cap->spark_stats.fizzled,
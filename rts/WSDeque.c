@@ -22,16 +22,28 @@
  * The write end of the queue (position bottom) can only be used with
  * mutual exclusion, i.e. by exactly one caller at a time.  At this
  * end, new items can be enqueued using pushBottom()/newSpark(), and
- * removed using popBottom()/reclaimSpark() (the latter implying a cas
- * synchronisation with potential concurrent readers for the case of
- * just one element).
+ * removed using popBottom()/reclaimSpark().  With fewer than
+ * WSDEQUE_STEAL_MAX elements left, the latter takes the oldest element
+ * with a cas, like a reader, since a reader may be taking a batch that
+ * reaches the bottom.
  * 
  * Multiple readers can steal from the read end (position top), and
  * are synchronised without a lock, based on a cas of the top
  * position. One reader wins, the others return NULL for a failure.
+ * A reader can take several elements with one cas (stealHalfWSDeque_),
+ * but never more than WSDEQUE_STEAL_MAX, nor beyond the bottom it saw.
  * 
  * Both popWSDeque and stealWSDeque also return NULL when the queue is empty.
  *
+ * When the array is full, pushWSDeque replaces it with one twice the
+ * size, copying the elements to the same positions (modulo the new
+ * size), as in the paper.  Thieves that read the old array before it
+ * was replaced may still be using it, so it can't be freed until no
+ * stealing is going on; it is kept on a list hanging off the new array
+ * until freeRetiredWSDeque, which the GC calls.  Each array carries its
+ * own size, so that a thief always indexes the array it read with the
+ * right modulo.
+ *
  * Testing: see testsuite/tests/rts/testwsdeque.c.  If
  * there's anything wrong with the deque implementation, this test
  * will probably catch it.
@@ -46,12 +58,45 @@
 
 #define CASTOP(addr,old,new) ((old) == cas(((StgPtr)addr),(old),(new)))
 
+/* The header in front of each elements array */
+typedef struct WSDequeArray_ {
+    struct WSDequeArray_ *retired; /* the array this one replaced */
+    StgWord moduloSize;            /* for thieves, see stealWSDeque_() */
+    void * elements[FLEXIBLE_ARRAY];
+} WSDequeArray;
+
+#define DEQUE_ARRAY(elems) \
+    ((WSDequeArray *)((StgWord8 *)(elems) - offsetof(WSDequeArray, elements)))
+
 /* -----------------------------------------------------------------------------
  * newWSDeque
  * -------------------------------------------------------------------------- */
 
 /* internal helpers ... */
 
+static void **
+newDequeArray (StgWord size, WSDequeArray *retired)
+{
+    WSDequeArray *a;
+
+    a = stgMallocBytes(sizeof(WSDequeArray) + size * sizeof(void *),
+                       "newWSDeque:data space");
+    a->retired = retired;
+    a->moduloSize = size - 1;
+    return a->elements;
+}
+
+static void
+freeDequeArrays (WSDequeArray *a)
+{
+    WSDequeArray *next;
+
+    for (; a != NULL; a = next) {
+        next = a->retired;
+        stgFree(a);
+    }
+}
+
 static StgWord
 roundUp2(StgWord val)
 {
@@ -78,8 +123,7 @@ newWSDeque (nat size)
     
     q = (WSDeque*) stgMallocBytes(sizeof(WSDeque),   /* admin fields */
                                   "newWSDeque");
-    q->elements = stgMallocBytes(realsize * sizeof(StgClosurePtr), /* dataspace */
-                                 "newWSDeque:data space");
+    q->elements = newDequeArray(realsize, NULL); /* dataspace */
     q->top=0;
     q->bottom=0;
     q->topBound=0; /* read by writer, updated each time top is read */
@@ -98,18 +142,31 @@ newWSDeque (nat size)
 void
 freeWSDeque (WSDeque *q)
 {
-    stgFree(q->elements);
+    freeDequeArrays(DEQUE_ARRAY(q->elements));
     stgFree(q);
 }
 
+void
+freeRetiredWSDeque (WSDeque *q)
+{
+    WSDequeArray *a = DEQUE_ARRAY(q->elements);
+
+    freeDequeArrays(a->retired);
+    a->retired = NULL;
+}
+
 /* -----------------------------------------------------------------------------
  * 
- * popWSDeque: remove an element from the write end of the queue.
- * Returns the removed spark, and NULL if a race is lost or the pool
+ * popWSDeque: remove an element from the queue.
+ * Returns the removed element, and NULL if a race is lost or the pool
  * empty.
  *
- * If only one spark is left in the pool, we synchronise with
- * concurrently stealing threads by using cas to modify the top field.
+ * With at least WSDEQUE_STEAL_MAX elements in the pool, the newest one
+ * is taken from the write end, without synchronisation (LIFO).  With
+ * fewer, a thief's batch may reach the bottom, so we synchronise with
+ * concurrently stealing threads by taking the oldest element from the
+ * read end with a cas on the top field, as a thief would (FIFO).  If
+ * that cas fails we return NULL, although elements may be left.
  * This routine should NEVER be called by a task which does not own
  * this deque.
  *
@@ -119,7 +176,8 @@ void *
 popWSDeque (WSDeque *q)
 {
     /* also a bit tricky, has to avoid concurrent steal() calls by
-       accessing top with cas, when there is only one element left */
+       accessing top with cas, when a batch stolen from top might
+       reach the bottom */
     StgWord t, b;
     long  currSize;
     void * removed;
@@ -147,19 +205,22 @@ popWSDeque (WSDeque *q)
         return NULL;
     }
 
-    // read the element at b
-    removed = q->elements[b & q->moduloSize];
-
-    if (currSize > 0) { /* no danger, still elements in buffer after b-- */
+    if (currSize >= WSDEQUE_STEAL_MAX) {
+        /* no danger: a thief that got hold of top t takes at most
+           WSDEQUE_STEAL_MAX elements from t on, which doesn't reach b */
+        removed = q->elements[b & q->moduloSize];
         // debugBelch("popWSDeque: t=%ld b=%ld = %ld\n", t, b, removed);
         return removed;
     } 
-    /* otherwise, has someone meanwhile stolen the same (last) element?
-       Check and increment top value to know  */
+    /* otherwise, a thief may be taking the elements up to b as we
+       speak.  Take the element at the top instead, with a cas like a
+       thief does, and give b back.  (With one element left, t == b.) */
+    removed = q->elements[t & q->moduloSize];
     if ( !(CASTOP(&(q->top),t,t+1)) ) {
         removed = NULL; /* no success, but continue adjusting bottom */
     }
-    q->bottom = t+1; /* anyway, empty now. Adjust bottom consistently. */
+    /* thieves never take beyond the bottom they saw, so top <= b+1 */
+    q->bottom = b+1;
     q->topBound = t+1; /* ...and cached top value as well */
     
     ASSERT_WSDEQUE_INVARIANTS(q); 
@@ -178,6 +239,7 @@ void *
 stealWSDeque_ (WSDeque *q)
 {
     void * stolen;
+    void ** elements;
     StgWord b,t; 
     
 // Can't do this on someone else's spark pool:
@@ -196,8 +258,13 @@ stealWSDeque_ (WSDeque *q)
         return NULL; /* already looks empty, abort */
   }
     
-    /* now access array, see pushBottom() */
-    stolen = q->elements[t & q->moduloSize];
+    /* now access array, see pushBottom().  Read the array after
+       bottom: an element we saw pushed is in the array we read, and
+       we take the size of that array, not q->moduloSize, which is
+       the owner's */
+    load_load_barrier();
+    elements = q->elements;
+    stolen = elements[t & DEQUE_ARRAY(elements)->moduloSize];
     
     /* now decide whether we have won */
     if ( !(CASTOP(&(q->top),t,t+1)) ) {
@@ -213,6 +280,50 @@ stealWSDeque_ (WSDeque *q)
     return stolen;
 }
 
+void *
+stealHalfWSDeque_ (WSDeque *q, WSDeque *into)
+{
+    void * stolen[WSDEQUE_STEAL_MAX];
+    void ** elements;
+    StgWord b, t, n, i;
+
+    // NB. these loads must be ordered, see stealWSDeque_()
+    t = q->top;
+    load_load_barrier();
+    b = q->bottom;
+
+    if ((long)b - (long)t <= 0 ) {
+        return NULL; /* already looks empty, abort */
+    }
+
+    /* half of what we saw, rounding up so that we still take the last
+       element */
+    n = (b - t + 1) / 2;
+    if (n > WSDEQUE_STEAL_MAX) {
+        n = WSDEQUE_STEAL_MAX;
+    }
+
+    /* read them before the cas, see stealWSDeque_() */
+    load_load_barrier();
+    elements = q->elements;
+    for (i = 0; i < n; i++) {
+        stolen[i] = elements[(t + i) & DEQUE_ARRAY(elements)->moduloSize];
+    }
+
+    if ( !(CASTOP(&(q->top),t,t+n)) ) {
+        /* lost the race, someone else has changed top in the meantime */
+        return NULL;
+    }
+
+    // debugBelch("stealHalfWSDeque_: t=%d b=%d n=%d\n", t, b, n);
+
+    /* in the order they had, so that thieves of ours take the oldest */
+    for (i = 1; i < n; i++) {
+        pushWSDeque(into, stolen[i]);
+    }
+    return stolen[0];
+}
+
 void *
 stealWSDeque (WSDeque *q)
 {
@@ -229,16 +340,35 @@ stealWSDeque (WSDeque *q)
  * pushWSQueue
  * -------------------------------------------------------------------------- */
 
-#define DISCARD_NEW
+/* Replace the array with one twice the size, holding the elements
+   from top to bottom at the same positions.  Elements a thief takes
+   from the old array meanwhile are taken from the new one too, since
+   it is top that says which ones are gone. */
+static void
+growWSDeque (WSDeque *q, StgWord t, StgWord b)
+{
+    void ** elements;
+    StgWord size, i;
+
+    size = q->size * 2;
+    elements = newDequeArray(size, DEQUE_ARRAY(q->elements));
+    for (i = t; i != b; i++) {
+        elements[i & (size - 1)] = q->elements[i & q->moduloSize];
+    }
+
+    // the copies must be visible before thieves can find the array
+    write_barrier();
+    q->elements = elements;
+    q->size = size;
+    q->moduloSize = size - 1;
+}
 
-/* enqueue an element. Should always succeed by resizing the array
-   (not implemented yet, silently fails in that case). */
-rtsBool
+/* enqueue an element, growing the array if it is full */
+void
 pushWSDeque (WSDeque* q, void * elem)
 {
     StgWord t;
     StgWord b;
-    StgWord sz = q->moduloSize; 
     
     ASSERT_WSDEQUE_INVARIANTS(q); 
     
@@ -248,37 +378,19 @@ pushWSDeque (WSDeque* q, void * elem)
     */
     b = q->bottom;
     t = q->topBound;
-    if ( (StgInt)b - (StgInt)t >= (StgInt)sz ) { 
-        /* NB. 1. sz == q->size - 1, thus ">="
+    if ( (StgInt)b - (StgInt)t >= (StgInt)q->moduloSize ) { 
+        /* NB. 1. moduloSize == q->size - 1, thus ">="
            2. signed comparison, it is possible that t > b
         */
         /* could be full, check the real top value in this case */
         t = q->top;
         q->topBound = t;
-        if (b - t >= sz) { /* really no space left :-( */
-            /* reallocate the array, copying the values. Concurrent steal()s
-               will in the meantime use the old one and modify only top.
-               This means: we cannot safely free the old space! Can keep it
-               on a free list internally here...
-               
-               Potential bug in combination with steal(): if array is
-               replaced, it is unclear which one concurrent steal operations
-               use. Must read the array base address in advance in steal().
-            */
-#if defined(DISCARD_NEW)
-            ASSERT_WSDEQUE_INVARIANTS(q); 
-            return rtsFalse; // we didn't push anything
-#else
-            /* could make room by incrementing the top position here.  In
-             * this case, should use CASTOP. If this fails, someone else has
-             * removed something, and new room will be available.
-             */
-            ASSERT_WSDEQUE_INVARIANTS(q); 
-#endif
+        if (b - t >= q->moduloSize) { /* really no space left */
+            growWSDeque(q, t, b);
         }
     }
 
-    q->elements[b & sz] = elem;
+    q->elements[b & q->moduloSize] = elem;
     /*
        KG: we need to put write barrier here since otherwise we might
        end with elem not added to q->elements, but q->bottom already
@@ -291,5 +403,4 @@ pushWSDeque (WSDeque* q, void * elem)
     q->bottom = b + 1;
     
     ASSERT_WSDEQUE_INVARIANTS(q); 
-    return rtsTrue;
 }
@@ -30,12 +30,16 @@ typedef struct WSDeque_ {
     // inside pushBottom
     volatile StgWord topBound;
 
-    // The elements array
+    // The elements array.  pushWSDeque() replaces it with one twice the
+    // size when it is full; size and moduloSize are the owner's copies
+    // of its size, thieves take the size from the array itself.
     void ** elements;
 
     //  Please note: the dataspace cannot follow the admin fields
     //  immediately, as it should be possible to enlarge it without
     //  disposing the old one automatically (as realloc would)!
+    //  Thieves may still be reading the old one, so it is kept until
+    //  freeRetiredWSDeque().
 
 } WSDeque;
 
@@ -62,21 +66,37 @@ typedef struct WSDeque_ {
  *
  * A WSDeque has an *owner* thread.  The owner can perform any operation;
  * other threads are only allowed to call stealWSDeque_(),
- * stealWSDeque(), looksEmptyWSDeque(), and dequeElements().
+ * stealWSDeque(), stealHalfWSDeque_(), looksEmptyWSDeque(), and
+ * dequeElements().
  *
  * -------------------------------------------------------------------------- */
 
+// Most elements stealHalfWSDeque_() takes at once.  popWSDeque() only
+// takes an element without a cas while there are at least this many
+// left, so that no batch can include it.
+#define WSDEQUE_STEAL_MAX 8
+
 // Allocation, deallocation
 WSDeque * newWSDeque  (nat size);
 void      freeWSDeque (WSDeque *q);
 
-// Take an element from the "write" end of the pool.  Can be called
-// by the pool owner only.
+// Frees the arrays the deque has outgrown.  Only safe when no thread
+// can be stealing from it, e.g. during GC for a spark pool, or once
+// the GC threads have stopped for a GC todo_q.
+void      freeRetiredWSDeque (WSDeque *q);
+
+// Take an element from the pool.  Can be called by the pool owner
+// only.  While the pool has at least WSDEQUE_STEAL_MAX elements this
+// is the newest one, taken from the "write" end without a cas.  With
+// fewer, it is the oldest one, taken from the "read" end with a cas
+// like a thief; if a thief wins the race, NULL is returned even though
+// the pool need not be empty, so callers must not take NULL to mean
+// empty (check looksEmptyWSDeque(), as steal loops do).
 void* popWSDeque (WSDeque *q);
 
-// Push onto the "write" end of the pool.  Return true if the push
-// succeeded, or false if the deque is full.
-rtsBool pushWSDeque (WSDeque *q, void *elem);
+// Push onto the "write" end of the pool, growing the array if the
+// deque is full.  Can be called by the pool owner only.
+void pushWSDeque (WSDeque *q, void *elem);
 
 // Removes all elements from the deque
 EXTERN_INLINE void discardElements (WSDeque *q);
@@ -90,6 +110,12 @@ void * stealWSDeque_ (WSDeque *q);
 // NULL if the pool is empty.
 void * stealWSDeque (WSDeque *q);
 
+// Removes up to half of the elements of the deque (at most
+// WSDEQUE_STEAL_MAX) from the "read" end with a single cas.  Returns
+// the first, and pushes the others onto into, which must be owned by
+// the caller.  Returns NULL like stealWSDeque_().
+void * stealHalfWSDeque_ (WSDeque *q, WSDeque *into);
+
 // "guesses" whether a deque is empty. Can return false negatives in
 //  presence of concurrent steal() calls, and false positives in
 //  presence of a concurrent pushBottom().
@@ -19,12 +19,22 @@
 
 #include <string.h>
 #include <stdio.h>
+#if (defined(i386_HOST_ARCH) || defined(x86_64_HOST_ARCH)) && defined(__GNUC__)
+#define HAVE_EVENTLOG_TSC
+#include <cpuid.h>
+#endif
 #ifdef HAVE_SYS_TYPES_H
 #include <sys/types.h>
 #endif
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#if !defined(mingw32_HOST_OS)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
 // PID of the process that writes to event_log_filename (#4512)
 static pid_t event_log_pid = -1;
@@ -34,10 +44,50 @@ static char *event_log_filename = NULL;
 // File for logging events
 FILE *event_log_file = NULL;
 
+/*
+ * Eventlog sinks
+ *
+ * All output goes through event_log_sink.  The built-in sinks write to
+ * a FILE (the default <prog>.eventlog) or to a file descriptor (given
+ * with --eventlog-fd, or opened for --eventlog-pipe and
+ * --eventlog-socket); a C host may also register its own sink with
+ * rts_setEventLogSink().
+ *
+ * The sink is only ever called with sink_mutex held, since full blocks
+ * are written by whichever capability (or the writer thread) filled
+ * them.  A block the sink fails to write is dropped, and after
+ * EVENT_LOG_MAX_WRITE_FAILURES failures in a row the sink is closed and
+ * the rest of the eventlog is dropped too: a collector at the other end
+ * of a pipe or socket has most likely gone away.
+ */
+static EventLogSink event_log_sink;
+static rtsBool      event_log_sink_open = rtsFalse;
+
+#define EVENT_LOG_MAX_WRITE_FAILURES 3
+
+static nat        event_log_write_failures; // in a row
+static StgWord64  event_log_dropped;        // blocks lost to the sink
+#ifdef THREADED_RTS
+static Mutex      sink_mutex;
+#endif
+
+static EventLogSink user_event_log_sink;
+static rtsBool      user_event_log_sink_set = rtsFalse;
+
+static int event_log_fd = -1;
+static rtsBool event_log_fd_socket = rtsFalse;
+
+static rtsBool event_log_forked = rtsFalse;
+
+static rtsBool openEventLogSink(void);
+static void closeEventLogSink(void);
+
 #define EVENT_LOG_SIZE 2 * (1024 * 1024) // 2MB
 
 static int flushCount;
 
+struct _EventsRing;
+
 // Struct for record keeping of buffer to store event types and events.
 typedef struct _EventsBuf {
   StgInt8 *begin;
@@ -45,15 +95,214 @@ typedef struct _EventsBuf {
   StgInt8 *marker;
   StgWord64 size;
   EventCapNo capno; // which capability this buffer belongs to, or -1
+  struct _EventsRing *ring; // flight recorder mode, or NULL
+
+  // compact blocks (+RTS --eventlog-compact)
+  StgWord64 block_time;     // timestamp of the open block marker
+  StgWord64 block_tsc;      // TSC at the open block marker (--eventlog-tsc)
+  StgInt8 *compact_len;     // length byte of the event being posted
+  rtsBool compact_fields;   // encode fields as ULEB128
 } EventsBuf;
 
+// Write compact blocks, see EventLogFormat.h
+static rtsBool event_log_compact = rtsFalse;
+
+/*
+ * Timestamps from the TSC (+RTS --eventlog-tsc)
+ *
+ * Reading the OS clock for every event is a good part of the cost of
+ * tracing.  With an invariant TSC, an event posted to a buffer with an
+ * open block is stamped with the time of its block marker, read from
+ * the OS clock, plus the TSC ticks since then.  Each block marker thus
+ * re-synchronises the two clocks.  The TSC rate is measured in
+ * initEventLogging(), and recorded in the log with
+ * EVENT_TSC_CALIBRATION.  Global events always use the OS clock.
+ */
+static rtsBool   event_log_tsc = rtsFalse;
+#ifdef HAVE_EVENTLOG_TSC
+#define TSC_SHIFT 24
+static StgWord64 tsc_hz;
+static StgWord64 tsc_mult;       // nanoseconds per tick << TSC_SHIFT
+static StgWord64 tsc_max_delta;  // ticks that can be converted
+#endif
+
 EventsBuf *capEventBuf; // one EventsBuf for each Capability
 
 EventsBuf eventBuf; // an EventsBuf not associated with any Capability
+
+/*
+ * The global event buffer
+ *
+ * Events that don't belong to a capability (capsets, messages, debug
+ * data, samples taken by the timer...) may be posted from any OS
+ * thread.  Rather than serialising them behind a mutex, each writer
+ * reserves space in eventBuf with a CAS on eventBufState, copies its
+ * event in, and then adds the event's size to eventBufCommitted.
+ *
+ * eventBufState holds the offset of the next free byte in eventBuf, a
+ * flag saying that the buffer is sealed, and a generation count that
+ * goes up each time the buffer is flushed, so that a stale reservation
+ * can never succeed.  A writer that finds no room seals the buffer,
+ * waits until all the space reserved so far has been committed, flushes
+ * it with printAndClearEventBuf() and publishes the empty buffer under
+ * the next generation; writers that find the buffer sealed wait for
+ * that.  endEventLogging() and the flight recorder seal the buffer in
+ * the same way.
+ *
+ * Each event is first encoded into a scratch buffer (GlobalEvent).  Its
+ * header is only written once space has been reserved, since in compact
+ * mode it depends on the start time of the current block.
+ */
+#define GLOBAL_OFFSET_BITS 22   // eventBuf blocks must be smaller than 4MB
+#define GLOBAL_OFFSET_MASK (((StgWord)1 << GLOBAL_OFFSET_BITS) - 1)
+#define GLOBAL_SEALED      ((StgWord)1 << GLOBAL_OFFSET_BITS)
+#define GLOBAL_GEN_SHIFT   (GLOBAL_OFFSET_BITS + 1)
+
+static volatile StgWord eventBufState;
+static volatile StgWord eventBufCommitted;
+static volatile StgWord eventBufClosed; // no more events, see endEventLogging
+#ifndef THREADED_RTS
+// Without other OS threads, the only writer we could ever wait for is
+// one we have interrupted (posting from a signal handler, say), which
+// can't go on until we return.  So a nested writer drops its event.
+static volatile StgWord eventBufBusy;
+#endif
+
+typedef struct _GlobalEvent {
+  EventsBuf    payload;     // the fields of the event, encoded
+  EventTypeNum type;
+  StgWord64    time;
+  rtsBool      variable;    // variable-size event
+  StgInt8      small[128];  // payload memory for most events
+} GlobalEvent;
+
+static void beginGlobalEvent(GlobalEvent *ev, EventTypeNum type,
+                             StgWord64 time, nat payload_bytes);
+static void endGlobalEvent(GlobalEvent *ev);
+static void sealGlobalEventsBuf(void);
+static void unsealGlobalEventsBuf(void);
+
 #ifdef THREADED_RTS
-Mutex eventBufMutex; // protected by this mutex
+/*
+ * Background writer (+RTS --eventlog-async)
+ *
+ * Instead of calling fwrite() on whichever capability happens to fill
+ * its buffer, printAndClearEventBuf() hands the full buffer over to a
+ * dedicated writer thread and carries on logging into a spare buffer
+ * taken from a fixed pool.  The writer returns buffers to the pool once
+ * they have been written out.  If the pool runs dry the capability has
+ * to wait for the writer after all, which is counted in writer_blocked;
+ * buffers the writer could not write are counted in writer_dropped.
+ */
+typedef struct _WriterBuf {
+  StgInt8 *begin;
+  StgWord64 size;     // number of bytes to write
+} WriterBuf;
+
+static rtsBool    writer_running = rtsFalse;
+static rtsBool    writer_stop;
+static rtsBool    writer_exited;
+static Mutex      writer_mutex;
+static Condition  writer_work;  // the queue is non-empty, or writer_stop
+static Condition  writer_idle;  // a buffer went back to the pool
+
+static nat        writer_pool_size;
+static StgInt8  **writer_free;  // stack of spare buffers
+static nat        writer_n_free;
+static WriterBuf *writer_queue; // ring of full buffers, oldest first
+static nat        writer_queue_head;
+static nat        writer_queue_len;
+
+static StgWord64  writer_written;
+static StgWord64  writer_blocked;
+static StgWord64  writer_dropped;
+
+static void startEventLogWriter(void);
+static void stopEventLogWriter(void);
+static void drainEventLogWriter(void);
+static StgInt8 *handOffEventsBuf(StgInt8 *begin, StgWord64 size);
 #endif
 
+/*
+ * Flight recorder (+RTS --eventlog-ring=<size>)
+ *
+ * Nothing is written while the program runs.  Each EventsBuf instead
+ * owns a ring of EVENT_RING_BLOCK_SIZE blocks adding up to <size>
+ * bytes; printAndClearEventBuf() just moves on to the next block of
+ * the ring, overwriting the oldest one.  The header is kept aside in
+ * event_log_header, and the first <size> bytes of the global eventBuf
+ * (startup information, capability sets, debug data) are pinned
+ * rather than recycled, so every dump can be read on its own.
+ *
+ * A dump is written at endEventLogging() (which covers hs_exit() and
+ * barf()), and whenever one has been requested with
+ * requestEventLogDump(), at the next point where all capabilities are
+ * stopped (see dumpRequestedEventLog()).
+ */
+#define EVENT_RING_BLOCK_SIZE (256 * 1024)
+
+typedef struct _EventsRing {
+  StgInt8  **blocks;      // one buffer per slot, blocks[cur] is in use
+  StgWord64 *used;        // bytes in each filled slot, 0 if empty
+  nat        n_blocks;
+  nat        cur;
+  StgInt8  **pinned;      // filled blocks that are never recycled
+  StgWord64 *pinned_used;
+  nat        n_pinned;
+  nat        max_pinned;
+} EventsRing;
+
+static nat        ring_dumps;
+static volatile StgWord eventlog_dump_requested = 0;
+
+static void initEventsRing(EventsBuf *eb, StgWord64 ring_size,
+                           nat max_pinned, EventCapNo capno);
+static void freeEventsRing(EventsBuf *eb);
+static StgInt8 *rotateEventsRing(EventsRing *ring, StgWord64 size);
+static void writeEventsRing(EventsRing *ring);
+static void dumpEventLogRings(void);
+
+/*
+ * Rotation (--eventlog-rotate-size, --eventlog-rotate-time): once the
+ * current file is big or old enough, it is finished at the next block
+ * boundary and <prog>.<pid>.<seq>.eventlog is started, beginning with
+ * a copy of the header.  Each segment is a complete eventlog.
+ */
+static rtsBool    event_log_rotate = rtsFalse;
+static char      *event_log_stem = NULL;   // <prog>.<pid>
+static nat        event_log_seq;
+static StgWord64  segment_bytes;           // written to the current file
+static rtsBool    segment_broken;          // a write to it failed
+static Time       segment_start;
+
+/*
+ * Index (--eventlog-index): where each block went in the current file,
+ * written out after EVENT_DATA_END (see EventLogFormat.h).
+ */
+typedef struct _IndexEntry {
+    StgWord64  offset;
+    StgWord64  start;
+    StgWord64  end;
+    EventCapNo capno;
+} IndexEntry;
+
+static rtsBool     event_log_index = rtsFalse;
+static IndexEntry *index_entries = NULL;
+static nat         index_len;
+static nat         index_size;
+
+// With rotation or an index, writeEventBlock() keeps track of what
+// goes where in the file (under sink_mutex).
+static rtsBool    track_blocks = rtsFalse;
+
+static StgBool writeEventBlock(void *data, StgWord64 size);
+static void finishEventLogFile(void);
+
+// The header and event types, as written at the start of the eventlog
+// (kept for the flight recorder and rotation).
+static StgInt8   *event_log_header = NULL;
+static StgWord64  event_log_header_size;
+
 char *EventDesc[] = {
   [EVENT_CREATE_THREAD]       = "Create thread",
   [EVENT_RUN_THREAD]          = "Run thread",
@@ -63,6 +312,12 @@ char *EventDesc[] = {
   [EVENT_SHUTDOWN]            = "Shutdown",
   [EVENT_THREAD_WAKEUP]       = "Wakeup thread",
   [EVENT_THREAD_LABEL]        = "Thread label",
+  [EVENT_TSC_CALIBRATION]     = "TSC calibration",
+  [EVENT_GC_STATS]            = "GC statistics",
+  [EVENT_GC_GEN_STATS]        = "GC generation statistics",
+  [EVENT_GC_THREAD_STATS]     = "GC thread statistics",
+  [EVENT_THREAD_BLOCKED]      = "Thread blocked",
+  [EVENT_THREAD_UNBLOCKED]    = "Thread unblocked",
   [EVENT_GC_START]            = "Starting GC",
   [EVENT_GC_END]              = "Finished GC",
   [EVENT_REQUEST_SEQ_GC]      = "Request sequential GC",
@@ -102,6 +357,12 @@ char *EventDesc[] = {
   [EVENT_DEBUG_CORE]          = "Debug core data",
   [EVENT_DEBUG_NAME]          = "Debug name data",
   [EVENT_DEBUG_PTR_RANGE]     = "Debug pointer range",
+  [EVENT_PROC_SAMPLES]        = "Procedure samples",
+  [EVENT_PERF_SAMPLE]         = "Performance counter sample",
+  [EVENT_STACK_SAMPLE]        = "Stack sample",
+  [EVENT_GC_PHASE_COUNTERS]   = "GC phase counters",
+  [EVENT_THREAD_COUNTERS]     = "Thread counters",
+  [EVENT_INFO_TABLE_SAMPLES]  = "Info table samples",
 };
 
 // Event type. 
@@ -114,9 +375,357 @@ typedef struct _EventType {
 
 EventType eventTypes[NUM_GHC_EVENT_TAGS];
 
+static HsBool writeFileSink(void *user, void *data, HsWord size)
+{
+    HsWord written;
+
+    written = fwrite(data, 1, size, (FILE *)user);
+    if (written != size) {
+        debugBelch(
+            "printAndClearEventLog: fwrite() failed, written=%" FMT_Word64
+            " doesn't match numBytes=%" FMT_Word64,
+            (StgWord64)written, (StgWord64)size);
+        return HS_BOOL_FALSE;
+    }
+    return HS_BOOL_TRUE;
+}
+
+static void flushFileSink(void *user)
+{
+    fflush((FILE *)user);
+}
+
+static void closeFileSink(void *user)
+{
+    fclose((FILE *)user);
+}
+
+static void setFileSink(FILE *f)
+{
+    event_log_sink.user  = f;
+    event_log_sink.write = writeFileSink;
+    event_log_sink.flush = flushFileSink;
+    event_log_sink.close = closeFileSink;
+}
+
+#if !defined(mingw32_HOST_OS)
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0            // SO_NOSIGPIPE is set on the socket instead
+#endif
+
+static HsBool writeFdSink(void *user, void *data, HsWord size)
+{
+    int fd = *(int *)user;
+    char *p = data;
+    ssize_t r;
+
+    while (size > 0) {
+        if (event_log_fd_socket) {
+            // a collector going away must not kill us with SIGPIPE
+            r = send(fd, p, size, SEND_FLAGS);
+        } else {
+            r = write(fd, p, size);
+        }
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            sysErrorBelch("printAndClearEventLog: write() failed");
+            return HS_BOOL_FALSE;
+        }
+        p += r;
+        size -= r;
+    }
+    return HS_BOOL_TRUE;
+}
+
+static void closeFdSink(void *user)
+{
+    close(*(int *)user);
+}
+
+static void setFdSink(int fd, rtsBool socket)
+{
+    event_log_fd = fd;
+    event_log_fd_socket = socket;
+    event_log_sink.user  = &event_log_fd;
+    event_log_sink.write = writeFdSink;
+    event_log_sink.flush = NULL;
+    event_log_sink.close = closeFdSink;
+}
+
+static int connectEventLogSocket(char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+    int one = 1;
+#endif
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+#endif
+
+void setEventLogSink(const EventLogSink *sink)
+{
+    user_event_log_sink = *sink;
+    user_event_log_sink_set = rtsTrue;
+}
+
+// Open the sink selected by the RTS flags, or the one registered by
+// the host.  A forked child always writes to <prog>.<pid>.eventlog, so
+// that its events do not get mixed up with those of its parent.
+rtsBool openEventLogSink(void)
+{
+    FILE *f;
+    nat sink;
+
+    if (user_event_log_sink_set && !event_log_forked) {
+        event_log_sink = user_event_log_sink;
+        event_log_sink_open = rtsTrue;
+        return rtsTrue;
+    }
+
+    sink = event_log_forked ? EVENTLOG_SINK_FILE : RtsFlags.TraceFlags.sink;
+    switch (sink) {
+#if !defined(mingw32_HOST_OS)
+    case EVENTLOG_SINK_FD:
+        setFdSink(RtsFlags.TraceFlags.sinkFd, rtsFalse);
+        break;
+
+    case EVENTLOG_SINK_PIPE:
+    {
+        // no O_CREAT: if the pipe isn't there, don't make a regular file
+        int fd = open(RtsFlags.TraceFlags.sinkPath, O_WRONLY);
+        if (fd < 0) {
+            sysErrorBelch("initEventLogging: can't open %s",
+                          RtsFlags.TraceFlags.sinkPath);
+            return rtsFalse;
+        }
+        setFdSink(fd, rtsFalse);
+        break;
+    }
+
+    case EVENTLOG_SINK_SOCKET:
+    {
+        int fd = connectEventLogSocket(RtsFlags.TraceFlags.sinkPath);
+        if (fd < 0) {
+            sysErrorBelch("initEventLogging: can't connect to %s",
+                          RtsFlags.TraceFlags.sinkPath);
+            return rtsFalse;
+        }
+        setFdSink(fd, rtsTrue);
+        break;
+    }
+#endif
+
+    default:
+        if ((f = fopen(event_log_filename, "wb")) == NULL) {
+            sysErrorBelch("initEventLogging: can't open %s",
+                          event_log_filename);
+            return rtsFalse;
+        }
+        event_log_file = f;
+        setFileSink(f);
+        break;
+    }
+
+    event_log_sink_open = rtsTrue;
+    return rtsTrue;
+}
+
+void closeEventLogSink(void)
+{
+    if (event_log_sink_open) {
+        if (event_log_sink.close != NULL) {
+            event_log_sink.close(event_log_sink.user);
+        }
+        event_log_sink_open = rtsFalse;
+        event_log_file = NULL;
+    }
+    event_log_write_failures = 0;
+}
+
+// Write to the sink, with sink_mutex held.
+static StgBool writeEventLog(void *data, StgWord64 size)
+{
+    if (!event_log_sink_open) {
+        event_log_dropped++;
+        return rtsFalse;
+    }
+    if (event_log_sink.write(event_log_sink.user, data, size)) {
+        event_log_write_failures = 0;
+        return rtsTrue;
+    }
+    event_log_dropped++;
+    if (++event_log_write_failures >= EVENT_LOG_MAX_WRITE_FAILURES) {
+        errorBelch("eventlog: %d writes failed in a row, "
+                   "dropping the rest of the eventlog",
+                   EVENT_LOG_MAX_WRITE_FAILURES);
+        closeEventLogSink();
+    }
+    return rtsFalse;
+}
+
+#ifdef THREADED_RTS
+
+static void OSThreadProcAttr
+eventLogWriter (void *unused STG_UNUSED)
+{
+    WriterBuf wb;
+    StgBool ok;
+
+    ACQUIRE_LOCK(&writer_mutex);
+    for (;;) {
+        while (writer_queue_len == 0 && !writer_stop) {
+            waitCondition(&writer_work, &writer_mutex);
+        }
+        if (writer_queue_len == 0) {
+            break; // stopped, and nothing left to write
+        }
+
+        wb = writer_queue[writer_queue_head];
+        writer_queue_head = (writer_queue_head + 1) % writer_pool_size;
+        writer_queue_len--;
+
+        RELEASE_LOCK(&writer_mutex);
+        ok = writeEventBlock(wb.begin, wb.size);
+        ACQUIRE_LOCK(&writer_mutex);
+
+        if (ok) {
+            writer_written++;
+        } else {
+            writer_dropped++;
+        }
+        writer_free[writer_n_free++] = wb.begin;
+        broadcastCondition(&writer_idle);
+    }
+    writer_exited = rtsTrue;
+    broadcastCondition(&writer_idle);
+    RELEASE_LOCK(&writer_mutex);
+}
+
+void startEventLogWriter(void)
+{
+    OSThreadId tid;
+    nat i;
+
+    writer_pool_size = RtsFlags.TraceFlags.asyncBuffers;
+    writer_free = stgMallocBytes(writer_pool_size * sizeof(StgInt8 *),
+                                 "startEventLogWriter");
+    writer_queue = stgMallocBytes(writer_pool_size * sizeof(WriterBuf),
+                                  "startEventLogWriter");
+    for (i = 0; i < writer_pool_size; i++) {
+        writer_free[i] = stgMallocBytes(EVENT_LOG_SIZE, "startEventLogWriter");
+    }
+    writer_n_free = writer_pool_size;
+    writer_queue_head = 0;
+    writer_queue_len = 0;
+    writer_stop = rtsFalse;
+    writer_exited = rtsFalse;
+    writer_written = 0;
+    writer_blocked = 0;
+    writer_dropped = 0;
+
+    initMutex(&writer_mutex);
+    initCondition(&writer_work);
+    initCondition(&writer_idle);
+
+    if (createOSThread(&tid, eventLogWriter, NULL) != 0) {
+        sysErrorBelch("initEventLogging: can't start eventlog writer, "
+                      "writing synchronously");
+        return;
+    }
+    writer_running = rtsTrue;
+}
+
+void stopEventLogWriter(void)
+{
+    ACQUIRE_LOCK(&writer_mutex);
+    writer_stop = rtsTrue;
+    signalCondition(&writer_work);
+    while (!writer_exited) {
+        waitCondition(&writer_idle, &writer_mutex);
+    }
+    RELEASE_LOCK(&writer_mutex);
+
+    writer_running = rtsFalse;
+    closeCondition(&writer_work);
+    closeCondition(&writer_idle);
+    closeMutex(&writer_mutex);
+}
+
+// Wait until everything handed to the writer is on disk (or at least
+// in the stdio buffer).
+void drainEventLogWriter(void)
+{
+    ACQUIRE_LOCK(&writer_mutex);
+    while (writer_n_free < writer_pool_size) {
+        waitCondition(&writer_idle, &writer_mutex);
+    }
+    RELEASE_LOCK(&writer_mutex);
+}
+
+StgInt8 *handOffEventsBuf(StgInt8 *begin, StgWord64 size)
+{
+    StgInt8 *spare;
+
+    ACQUIRE_LOCK(&writer_mutex);
+    if (writer_n_free == 0) {
+        writer_blocked++;
+        do {
+            waitCondition(&writer_idle, &writer_mutex);
+        } while (writer_n_free == 0);
+    }
+    spare = writer_free[--writer_n_free];
+
+    writer_queue[(writer_queue_head + writer_queue_len) % writer_pool_size].begin = begin;
+    writer_queue[(writer_queue_head + writer_queue_len) % writer_pool_size].size = size;
+    writer_queue_len++;
+    signalCondition(&writer_work);
+    RELEASE_LOCK(&writer_mutex);
+
+    return spare;
+}
+
+void getEventLogWriterStats(StgWord64 *written,
+                            StgWord64 *blocked,
+                            StgWord64 *dropped)
+{
+    if (!writer_running) {
+        *written = *blocked = *dropped = 0;
+        return;
+    }
+    ACQUIRE_LOCK(&writer_mutex);
+    *written = writer_written;
+    *blocked = writer_blocked;
+    *dropped = writer_dropped;
+    RELEASE_LOCK(&writer_mutex);
+}
+
+#endif /* THREADED_RTS */
+
 static void initEventsBuf(EventsBuf* eb, StgWord64 size, EventCapNo capno);
 static void resetEventsBuf(EventsBuf* eb);
-static void printAndClearEventBuf (EventsBuf *eventsBuf);
+static StgBool printAndClearEventBuf (EventsBuf *eventsBuf);
 
 static void postEventType(EventsBuf *eb, EventType *et);
 
@@ -136,22 +745,60 @@ static inline void postWord8(EventsBuf *eb, StgWord8 i)
     *(eb->pos++) = i; 
 }
 
-static inline void postWord16(EventsBuf *eb, StgWord16 i)
+static inline void postRawWord16(EventsBuf *eb, StgWord16 i)
 {
     postWord8(eb, (StgWord8)(i >> 8));
     postWord8(eb, (StgWord8)i);
 }
 
+static inline void postRawWord32(EventsBuf *eb, StgWord32 i)
+{
+    postRawWord16(eb, (StgWord16)(i >> 16));
+    postRawWord16(eb, (StgWord16)i);
+}
+
+static inline void postRawWord64(EventsBuf *eb, StgWord64 i)
+{
+    postRawWord32(eb, (StgWord32)(i >> 32));
+    postRawWord32(eb, (StgWord32)i);
+}
+
+static inline void postULEB128(EventsBuf *eb, StgWord64 i)
+{
+    while (i >= 0x80) {
+        postWord8(eb, (StgWord8)(i | 0x80));
+        i >>= 7;
+    }
+    postWord8(eb, (StgWord8)i);
+}
+
+// The fields of fixed-size events are ULEB128 encoded in compact blocks.
+
+static inline void postWord16(EventsBuf *eb, StgWord16 i)
+{
+    if (eb->compact_fields) {
+        postULEB128(eb, i);
+    } else {
+        postRawWord16(eb, i);
+    }
+}
+
 static inline void postWord32(EventsBuf *eb, StgWord32 i)
 {
-    postWord16(eb, (StgWord16)(i >> 16));
-    postWord16(eb, (StgWord16)i);
+    if (eb->compact_fields) {
+        postULEB128(eb, i);
+    } else {
+        postRawWord32(eb, i);
+    }
 }
 
 static inline void postWord64(EventsBuf *eb, StgWord64 i)
 {
-    postWord32(eb, (StgWord32)(i >> 32));
-    postWord32(eb, (StgWord32)i);
+    if (eb->compact_fields) {
+        postULEB128(eb, i);
+    } else {
+        postRawWord64(eb, i);
+    }
 }
 
 static inline void postBuf(EventsBuf *eb, StgWord8 *buf, nat size)
@@ -163,12 +810,34 @@ static inline void postBuf(EventsBuf *eb, StgWord8 *buf, nat size)
 static inline StgWord64 time_ns(void)
 { return TimeToNS(stat_getElapsedTime()); }
 
+#ifdef HAVE_EVENTLOG_TSC
+static inline StgWord64 readTSC(void)
+{
+    StgWord32 lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((StgWord64)hi << 32) | lo;
+}
+#endif
+
+// The time of an event posted to eb now.
+static inline StgWord64 eventTime(EventsBuf *eb)
+{
+#ifdef HAVE_EVENTLOG_TSC
+    StgWord64 ticks;
+
+    if (event_log_tsc && eb->marker != NULL) {
+        ticks = readTSC() - eb->block_tsc;
+        if (ticks < tsc_max_delta) {
+            return eb->block_time + ((ticks * tsc_mult) >> TSC_SHIFT);
+        }
+    }
+#endif
+    return time_ns();
+}
+
 static inline void postEventTypeNum(EventsBuf *eb, EventTypeNum etNum)
 { postWord16(eb, etNum); }
 
-static inline void postTimestamp(EventsBuf *eb)
-{ postWord64(eb, time_ns()); }
-
 static inline void postThreadID(EventsBuf *eb, EventThreadID id)
 { postWord32(eb,id); }
 
@@ -181,14 +850,68 @@ static inline void postCapsetID(EventsBuf *eb, EventCapsetID id)
 static inline void postCapsetType(EventsBuf *eb, EventCapsetType type)
 { postWord16(eb,type); }
 
+/*
+ * In a compact block, the length of each event is only known once all
+ * of its fields have been posted.  postEventHeader() reserves one byte
+ * for it, and closeCompactEvent() fills it in when the next event is
+ * posted or the block is closed.  Fixed-size events always fit in
+ * 127 bytes, but debug data might not: then the payload has to move
+ * up a byte.
+ */
+static void closeCompactEvent(EventsBuf *eb)
+{
+    StgWord64 len;
+
+    if (eb->compact_len != NULL) {
+        len = eb->pos - (eb->compact_len + 1);
+        if (len < 0x80) {
+            *eb->compact_len = (StgInt8)len;
+        } else {
+            ASSERT(len < 0x4000);
+            memmove(eb->compact_len + 2, eb->compact_len + 1, len);
+            eb->compact_len[0] = (StgInt8)(len | 0x80);
+            eb->compact_len[1] = (StgInt8)(len >> 7);
+            eb->pos++;
+        }
+        eb->compact_len = NULL;
+    }
+    eb->compact_fields = rtsFalse;
+}
+
 static inline void postPayloadSize(EventsBuf *eb, EventPayloadSize size)
-{ postWord16(eb,size); }
+{
+    if (eb->compact_len != NULL) {
+        // variable-size event: we know the length after all, and the
+        // payload is posted as it is
+        eb->pos = eb->compact_len;
+        eb->compact_len = NULL;
+        eb->compact_fields = rtsFalse;
+        postULEB128(eb, size);
+    } else {
+        postWord16(eb,size);
+    }
+}
+
+static inline void postEventHeaderAt(EventsBuf *eb, EventTypeNum type,
+                                     StgWord64 ts)
+{
+    if (eb->marker != NULL && event_log_compact) {
+        closeCompactEvent(eb);
+        postULEB128(eb, type);
+        postULEB128(eb, ts > eb->block_time ? ts - eb->block_time : 0);
+        eb->compact_len = eb->pos;
+        postWord8(eb, 0);
+        eb->compact_fields = rtsTrue;
+    } else {
+        postEventTypeNum(eb, type);
+        postWord64(eb, ts);
+    }
+}
 
 static inline void postEventHeader(EventsBuf *eb, EventTypeNum type)
 {
-    postEventTypeNum(eb, type);
-    postTimestamp(eb);
-}    
+    postEventHeaderAt(eb, type, eventTime(eb));
+}
 
 static inline void postInt8(EventsBuf *eb, StgInt8 i)
 { postWord8(eb, (StgWord8)i); }
@@ -267,6 +990,10 @@ static StgWord16 getEventSize(EventTypeNum t)
     case EVENT_HPC_MODULE:       // (name, boxes, hash)
     case EVENT_TICK_DUMP:        // (freqs, counts)
     case EVENT_INSTR_PTR_SAMPLE: // (ips)
+    case EVENT_PROC_SAMPLES:     // (cnt * (proc, samples))
+    case EVENT_PERF_SAMPLE:      // (cap, counters, cnt * (ip, values))
+    case EVENT_STACK_SAMPLE:     // (thread, cnt * frame)
+    case EVENT_INFO_TABLE_SAMPLES: // (cap, cnt * (info, samples))
     case EVENT_DEBUG_MODULE: // (variable)
     case EVENT_DEBUG_PROCEDURE: // (variable)
     case EVENT_DEBUG_SOURCE: // (variable)
@@ -287,12 +1014,94 @@ static StgWord16 getEventSize(EventTypeNum t)
     case EVENT_WALL_CLOCK_TIME: // (capset, unix_epoch_seconds, nanoseconds)
         return sizeof(EventCapsetID) + sizeof(StgWord64) + sizeof(StgWord32);
 
+    case EVENT_TSC_CALIBRATION: // (ticks_per_sec, tsc)
+        return sizeof(StgWord64) + sizeof(StgWord64);
+
+    case EVENT_GC_STATS:        // (gen, alloc, copied, live, slop,
+                                //  par_n_threads, par_max_copied,
+                                //  par_tot_copied)
+        return sizeof(StgWord16) + 4 * sizeof(StgWord64) +
+               sizeof(StgWord16) + 2 * sizeof(StgWord64);
+
+    case EVENT_GC_GEN_STATS:    // (gen, size, live, slop, large)
+        return sizeof(StgWord16) + 4 * sizeof(StgWord64);
+
+    case EVENT_GC_THREAD_STATS: // (gc_thread, copied, scanned, any_work,
+                                //  no_work, scav_find_work)
+        return sizeof(StgWord16) + 5 * sizeof(StgWord64);
+
+    case EVENT_GC_PHASE_COUNTERS: // (gc_thread, phase, cache_misses,
+                                  //  dtlb_misses)
+        return 2 * sizeof(StgWord16) + 2 * sizeof(StgWord64);
+
+    case EVENT_THREAD_COUNTERS: // (thread, cycles, instructions,
+                                //  cache_misses)
+        return sizeof(EventThreadID) + 3 * sizeof(StgWord64);
+
+    case EVENT_THREAD_BLOCKED:  // (thread, reason, object, owner, thread_cap)
+        return sizeof(EventThreadID) + sizeof(StgWord16) +
+               sizeof(StgWord64) + sizeof(EventThreadID) + sizeof(EventCapNo);
+
+    case EVENT_THREAD_UNBLOCKED: // (thread, object, waker, thread_cap)
+        return sizeof(EventThreadID) + sizeof(StgWord64) +
+               sizeof(EventThreadID) + sizeof(EventCapNo);
+
     default:
         return EVENT_SIZE_DEPRECATED; /* ignore deprecated events */
     }
 
 }
 
+#ifdef HAVE_EVENTLOG_TSC
+// Measure the TSC rate against the OS clock, if the TSC runs at a
+// constant rate (and is synchronised between cores).
+static rtsBool calibrateTSC(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    StgWord64 tsc0, tsc1;
+    Time t0, t1;
+
+    // CPUID.80000007H:EDX[8] is "invariant TSC"
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) ||
+        !(edx & (1 << 8))) {
+        return rtsFalse;
+    }
+
+    t0 = stat_getElapsedTime();
+    tsc0 = readTSC();
+    do {
+        t1 = stat_getElapsedTime();
+    } while (t1 - t0 < USToTime(10000));
+    tsc1 = readTSC();
+
+    if (tsc1 <= tsc0) {
+        return rtsFalse;
+    }
+    tsc_hz = (tsc1 - tsc0) * TIME_RESOLUTION / (t1 - t0);
+    tsc_mult = ((StgWord64)TIME_RESOLUTION << TSC_SHIFT) / tsc_hz;
+    if (tsc_mult == 0) {
+        return rtsFalse;
+    }
+    tsc_max_delta = ~(StgWord64)0 / tsc_mult;
+    return rtsTrue;
+}
+
+static void postTSCCalibration(void)
+{
+    GlobalEvent ev;
+    StgWord64 ts, tsc;
+
+    ts = time_ns();
+    tsc = readTSC();
+
+    beginGlobalEvent(&ev, EVENT_TSC_CALIBRATION, ts,
+                     eventTypes[EVENT_TSC_CALIBRATION].size);
+    postWord64(&ev.payload, tsc_hz);
+    postWord64(&ev.payload, tsc);
+    endGlobalEvent(&ev);
+}
+#endif
+
 void
 initEventLogging(void)
 {
@@ -315,6 +1124,7 @@ initEventLogging(void)
 
     event_log_filename = stgMallocBytes(strlen(prog)
                                         + 10 /* .%d */
+                                        + 10 /* .%u */
                                         + 10 /* .eventlog */,
                                         "initEventLogging");
 
@@ -330,13 +1140,39 @@ initEventLogging(void)
         // Forked process, eventlog already started by the parent
         // before fork
         event_log_pid = getpid();
+        event_log_forked = rtsTrue;
         sprintf(event_log_filename, "%s.%d.eventlog", prog, event_log_pid);
     }
+
+    // Rotation only makes sense for files we name ourselves.
+    event_log_rotate =
+        (RtsFlags.TraceFlags.rotateSize != 0 ||
+         RtsFlags.TraceFlags.rotateTime != 0) &&
+        RtsFlags.TraceFlags.ringSize == 0 &&
+        (event_log_forked ||
+         (!user_event_log_sink_set &&
+          RtsFlags.TraceFlags.sink == EVENTLOG_SINK_FILE));
+    if (event_log_rotate) {
+        event_log_stem = stgMallocBytes(strlen(prog) + 10 /* .%d */ + 1,
+                                        "initEventLogging");
+        sprintf(event_log_stem, "%s.%d", prog, event_log_pid);
+        event_log_seq = 0;
+        sprintf(event_log_filename, "%s.%u.eventlog",
+                event_log_stem, event_log_seq);
+    }
     stgFree(prog);
 
-    /* Open event log file for writing. */
-    if ((event_log_file = fopen(event_log_filename, "wb")) == NULL) {
-        sysErrorBelch("initEventLogging: can't open %s", event_log_filename);
+    event_log_index = RtsFlags.TraceFlags.index &&
+                      RtsFlags.TraceFlags.ringSize == 0;
+
+#ifdef THREADED_RTS
+    initMutex(&sink_mutex);
+#endif
+    event_log_dropped = 0;
+
+    /* Open the event log sink for writing, unless we only write it on
+     * demand (flight recorder). */
+    if (RtsFlags.TraceFlags.ringSize == 0 && !openEventLogSink()) {
         stg_exit(EXIT_FAILURE);    
     }
 
@@ -363,6 +1199,19 @@ initEventLogging(void)
     // Write in buffer: the header begin marker.
     postInt32(&eventBuf, EVENT_HEADER_BEGIN);
 
+#ifdef HAVE_EVENTLOG_TSC
+    event_log_tsc = RtsFlags.TraceFlags.tsc && calibrateTSC();
+#else
+    event_log_tsc = rtsFalse;
+#endif
+
+    // Header flags, if any
+    event_log_compact = RtsFlags.TraceFlags.compact;
+    if (event_log_compact) {
+        postInt32(&eventBuf, EVENT_HEADER_FLAGS);
+        postWord32(&eventBuf, EVENT_HEADER_FLAG_COMPACT);
+    }
+
     // Mark beginning of event types in the header.
     postInt32(&eventBuf, EVENT_HET_BEGIN);
     for (t = 0; t < NUM_GHC_EVENT_TAGS; ++t) {
@@ -390,16 +1239,56 @@ initEventLogging(void)
     // Flush capEventBuf with header.
     /*
      * Flush header and data begin marker to the file, thus preparing the
-     * file to have events written to it.
+     * file to have events written to it.  The flight recorder keeps the
+     * header for each dump instead.
      */
-    printAndClearEventBuf(&eventBuf);
-
-    for (c = 0; c < n_caps; ++c) {
-        postBlockMarker(&capEventBuf[c]);
+    if (RtsFlags.TraceFlags.ringSize != 0) {
+        event_log_header_size = eventBuf.pos - eventBuf.begin;
+        event_log_header = stgReallocBytes(eventBuf.begin, event_log_header_size,
+                                      "initEventLogging");
+        initEventsRing(&eventBuf, RtsFlags.TraceFlags.ringSize,
+                       RtsFlags.TraceFlags.ringSize / EVENT_RING_BLOCK_SIZE,
+                       (EventCapNo)(-1));
+        postBlockMarker(&eventBuf);
+    } else {
+        if (event_log_rotate) {
+            event_log_header_size = eventBuf.pos - eventBuf.begin;
+            event_log_header = stgMallocBytes(event_log_header_size,
+                                              "initEventLogging");
+            memcpy(event_log_header, eventBuf.begin, event_log_header_size);
+        }
+        if (event_log_rotate || event_log_index) {
+            track_blocks = rtsTrue;
+            segment_bytes = 0;
+            segment_broken = rtsFalse;
+            segment_start = stat_getElapsedTime();
+            index_len = 0;
+        }
+        printAndClearEventBuf(&eventBuf);
     }
 
+    for (c = 0; c < n_caps; ++c) {
+        postBlockMarker(&capEventBuf[c]);
+    }
+
+    // eventBuf is now open to writers from any thread
+    eventBufClosed = 0;
+    eventBufState = 0;
+    unsealGlobalEventsBuf();
+
+#ifdef HAVE_EVENTLOG_TSC
+    if (event_log_tsc) {
+        postTSCCalibration();
+    }
+#endif
+
 #ifdef THREADED_RTS
-    initMutex(&eventBufMutex);
+    // The header has been written synchronously above, so from here on
+    // blocks may be handed to the writer in any order.
+    if (RtsFlags.TraceFlags.asyncWriter &&
+        RtsFlags.TraceFlags.ringSize == 0) {
+        startEventLogWriter();
+    }
 #endif
 }
 
@@ -408,21 +1297,43 @@ endEventLogging(void)
 {
     nat c;
 
+    // From now on, events for eventBuf are dropped.
+    sealGlobalEventsBuf();
+    eventBufClosed = 1;
+
+    if (eventBuf.ring != NULL) {
+        // Flight recorder: write out what is left in the rings.
+        ACQUIRE_LOCK(&sink_mutex);
+        if (openEventLogSink()) {
+            dumpEventLogRings();
+            closeEventLogSink();
+        }
+        RELEASE_LOCK(&sink_mutex);
+        return;
+    }
+
     // Flush all events remaining in the buffers.
     for (c = 0; c < n_capabilities; ++c) {
         printAndClearEventBuf(&capEventBuf[c]);
     }
     printAndClearEventBuf(&eventBuf);
-    resetEventsBuf(&eventBuf); // we don't want the block marker
 
-    // Mark end of events (data).
-    postEventTypeNum(&eventBuf, EVENT_DATA_END);
+#ifdef THREADED_RTS
+    // Wait for the writer to finish, the end marker must come last.
+    if (writer_running) {
+        stopEventLogWriter();
+    }
+#endif
 
-    // Flush the end of data marker.
-    printAndClearEventBuf(&eventBuf);
+    // Mark end of events (data), and write the index if any.
+    ACQUIRE_LOCK(&sink_mutex);
+    finishEventLogFile();
+    closeEventLogSink();
+    RELEASE_LOCK(&sink_mutex);
 
-    if (event_log_file != NULL) {
-        fclose(event_log_file);
+    if (event_log_dropped != 0) {
+        errorBelch("eventlog: %" FMT_Word64 " blocks could not be written",
+                   event_log_dropped);
     }
 }
 
@@ -440,7 +1351,12 @@ moreCapEventBufs (nat from, nat to)
     }
 
     for (c = from; c < to; ++c) {
-        initEventsBuf(&capEventBuf[c], EVENT_LOG_SIZE, c);
+        if (RtsFlags.TraceFlags.ringSize != 0) {
+            initEventsRing(&capEventBuf[c], RtsFlags.TraceFlags.ringSize,
+                           0, c);
+        } else {
+            initEventsBuf(&capEventBuf[c], EVENT_LOG_SIZE, c);
+        }
     }
 }
 
@@ -448,12 +1364,22 @@ moreCapEventBufs (nat from, nat to)
 void
 freeEventLogging(void)
 {
-    StgWord8 c;
+    nat c;
     
     // Free events buffer.
     for (c = 0; c < n_capabilities; ++c) {
-        if (capEventBuf[c].begin != NULL) 
+        if (capEventBuf[c].ring != NULL) {
+            freeEventsRing(&capEventBuf[c]);
+        } else if (capEventBuf[c].begin != NULL) {
             stgFree(capEventBuf[c].begin);
+        }
+    }
+    if (eventBuf.ring != NULL) {
+        freeEventsRing(&eventBuf);
+    }
+    if (event_log_header != NULL) {
+        stgFree(event_log_header);
+        event_log_header = NULL;
     }
     if (capEventBuf != NULL)  {
         stgFree(capEventBuf);
@@ -461,23 +1387,62 @@ freeEventLogging(void)
     if (event_log_filename != NULL) {
         stgFree(event_log_filename);
     }
+    if (event_log_stem != NULL) {
+        stgFree(event_log_stem);
+        event_log_stem = NULL;
+        event_log_rotate = rtsFalse;
+    }
+    if (index_entries != NULL) {
+        stgFree(index_entries);
+        index_entries = NULL;
+        index_size = 0;
+    }
+    track_blocks = rtsFalse;
+#ifdef THREADED_RTS
+    closeMutex(&sink_mutex);
+    if (writer_free != NULL) {
+        for (c = 0; c < writer_n_free; ++c) {
+            stgFree(writer_free[c]);
+        }
+        stgFree(writer_free);
+        stgFree(writer_queue);
+        writer_free = NULL;
+        writer_queue = NULL;
+    }
+#endif
 }
 
 void 
 flushEventLog(void)
 {
-    if (event_log_file != NULL) {
-        fflush(event_log_file);
+#ifdef THREADED_RTS
+    if (writer_running) {
+        drainEventLogWriter();
+    }
+#endif
+    if (event_log_sink_open && event_log_sink.flush != NULL) {
+        ACQUIRE_LOCK(&sink_mutex);
+        if (event_log_sink_open) {
+            event_log_sink.flush(event_log_sink.user);
+        }
+        RELEASE_LOCK(&sink_mutex);
     }
 }
 
 void 
 abortEventLogging(void)
 {
+#ifdef THREADED_RTS
+    // After a fork the writer thread is gone; flushEventLog() made sure
+    // that it had returned all buffers to the pool beforehand.
+    writer_running = rtsFalse;
+#endif
     freeEventLogging();
-    if (event_log_file != NULL) {
-        fclose(event_log_file);
+    if (user_event_log_sink_set && !event_log_forked) {
+        // the sink registered by the host belongs to the parent
+        event_log_sink_open = rtsFalse;
     }
+    closeEventLogSink();
 }
 /*
  * Post an event message to the capability's eventlog buffer.
@@ -602,31 +1567,196 @@ postSparkCountersEvent (Capability *cap,
     postEventHeader(eb, EVENT_SPARK_COUNTERS);
     postWord64(eb,counters.created);
     postWord64(eb,counters.dud);
-    postWord64(eb,counters.overflowed);
+    postWord64(eb,0); // overflowed: spark pools grow, so never
     postWord64(eb,counters.converted);
     postWord64(eb,counters.gcd);
     postWord64(eb,counters.fizzled);
     postWord64(eb,remaining);
 }
 
+void
+postGcStatsEvent (Capability *cap,
+                  StgWord16   gen,
+                  StgWord64   alloc,
+                  StgWord64   copied,
+                  StgWord64   live,
+                  StgWord64   slop,
+                  StgWord16   par_n_threads,
+                  StgWord64   par_max_copied,
+                  StgWord64   par_tot_copied)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!ensureRoomForEvent(eb, EVENT_GC_STATS)) {
+        return;
+    }
+
+    postEventHeader(eb, EVENT_GC_STATS);
+    postWord16(eb, gen);
+    postWord64(eb, alloc);
+    postWord64(eb, copied);
+    postWord64(eb, live);
+    postWord64(eb, slop);
+    postWord16(eb, par_n_threads);
+    postWord64(eb, par_max_copied);
+    postWord64(eb, par_tot_copied);
+}
+
+void
+postGcGenStatsEvent (Capability *cap,
+                     StgWord16   gen,
+                     StgWord64   size,
+                     StgWord64   live,
+                     StgWord64   slop,
+                     StgWord64   large)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!ensureRoomForEvent(eb, EVENT_GC_GEN_STATS)) {
+        return;
+    }
+
+    postEventHeader(eb, EVENT_GC_GEN_STATS);
+    postWord16(eb, gen);
+    postWord64(eb, size);
+    postWord64(eb, live);
+    postWord64(eb, slop);
+    postWord64(eb, large);
+}
+
+void
+postGcThreadStatsEvent (Capability *cap,
+                        StgWord16   gc_thread,
+                        StgWord64   copied,
+                        StgWord64   scanned,
+                        StgWord64   any_work,
+                        StgWord64   no_work,
+                        StgWord64   scav_find_work)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!ensureRoomForEvent(eb, EVENT_GC_THREAD_STATS)) {
+        return;
+    }
+
+    postEventHeader(eb, EVENT_GC_THREAD_STATS);
+    postWord16(eb, gc_thread);
+    postWord64(eb, copied);
+    postWord64(eb, scanned);
+    postWord64(eb, any_work);
+    postWord64(eb, no_work);
+    postWord64(eb, scav_find_work);
+}
+
+void
+postGcPhaseCountersEvent (Capability *cap,
+                          StgWord16   gc_thread,
+                          StgWord16   phase,
+                          StgWord64   cache_misses,
+                          StgWord64   dtlb_misses)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!ensureRoomForEvent(eb, EVENT_GC_PHASE_COUNTERS)) {
+        return;
+    }
+
+    postEventHeader(eb, EVENT_GC_PHASE_COUNTERS);
+    postWord16(eb, gc_thread);
+    postWord16(eb, phase);
+    postWord64(eb, cache_misses);
+    postWord64(eb, dtlb_misses);
+}
+
+void
+postThreadCountersEvent (Capability    *cap,
+                         EventThreadID  thread,
+                         StgWord64      cycles,
+                         StgWord64      instructions,
+                         StgWord64      cache_misses)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!ensureRoomForEvent(eb, EVENT_THREAD_COUNTERS)) {
+        return;
+    }
+
+    postEventHeader(eb, EVENT_THREAD_COUNTERS);
+    postThreadID(eb, thread);
+    postWord64(eb, cycles);
+    postWord64(eb, instructions);
+    postWord64(eb, cache_misses);
+}
+
+void
+postThreadBlockedEvent (Capability    *cap,
+                        EventThreadID  thread,
+                        StgWord16      reason,
+                        StgWord64      object,
+                        EventThreadID  owner,
+                        EventCapNo     thread_cap)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!ensureRoomForEvent(eb, EVENT_THREAD_BLOCKED)) {
+        return;
+    }
+
+    postEventHeader(eb, EVENT_THREAD_BLOCKED);
+    postThreadID(eb, thread);
+    postWord16(eb, reason);
+    postWord64(eb, object);
+    postThreadID(eb, owner);
+    postCapNo(eb, thread_cap);
+}
+
+void
+postThreadUnblockedEvent (Capability    *cap,
+                          EventThreadID  thread,
+                          StgWord64      object,
+                          EventThreadID  waker,
+                          EventCapNo     thread_cap)
+{
+    EventsBuf *eb;
+
+    eb = &capEventBuf[cap->no];
+
+    if (!ensureRoomForEvent(eb, EVENT_THREAD_UNBLOCKED)) {
+        return;
+    }
+
+    postEventHeader(eb, EVENT_THREAD_UNBLOCKED);
+    postThreadID(eb, thread);
+    postWord64(eb, object);
+    postThreadID(eb, waker);
+    postCapNo(eb, thread_cap);
+}
+
 void postCapsetEvent (EventTypeNum tag,
                       EventCapsetID capset,
                       StgWord info)
 {
-    ACQUIRE_LOCK(&eventBufMutex);
+    GlobalEvent ev;
 
-    if (!hasRoomForEvent(&eventBuf, tag)) {
-        // Flush event buffer to make room for new event.
-        printAndClearEventBuf(&eventBuf);
-    }
-
-    postEventHeader(&eventBuf, tag);
-    postCapsetID(&eventBuf, capset);
+    beginGlobalEvent(&ev, tag, time_ns(), eventTypes[tag].size);
+    postCapsetID(&ev.payload, capset);
 
     switch (tag) {
     case EVENT_CAPSET_CREATE:   // (capset, capset_type)
     {
-        postCapsetType(&eventBuf, info /* capset_type */);
+        postCapsetType(&ev.payload, info /* capset_type */);
         break;
     }
 
@@ -638,48 +1768,36 @@ void postCapsetEvent (EventTypeNum tag,
     case EVENT_CAPSET_ASSIGN_CAP:  // (capset, capno)
     case EVENT_CAPSET_REMOVE_CAP:  // (capset, capno)
     {
-        postCapNo(&eventBuf, info /* capno */);
+        postCapNo(&ev.payload, info /* capno */);
         break;
     }
     case EVENT_OSPROCESS_PID:   // (capset, pid)
     case EVENT_OSPROCESS_PPID:  // (capset, parent_pid)
     {
-        postWord32(&eventBuf, info);
+        postWord32(&ev.payload, info);
         break;
     }
     default:
         barf("postCapsetEvent: unknown event tag %d", tag);
     }
 
-    RELEASE_LOCK(&eventBufMutex);
+    endGlobalEvent(&ev);
 }
 
 void postCapsetStrEvent (EventTypeNum tag,
                          EventCapsetID capset,
                          char *msg)
 {
+    GlobalEvent ev;
     int strsize = strlen(msg);
     int size = strsize + sizeof(EventCapsetID);
 
-    ACQUIRE_LOCK(&eventBufMutex);
+    beginGlobalEvent(&ev, tag, time_ns(), size);
+    postCapsetID(&ev.payload, capset);
 
-    if (!hasRoomForVariableEvent(&eventBuf, size)){
-        printAndClearEventBuf(&eventBuf);
+    postBuf(&ev.payload, (StgWord8*) msg, strsize);
 
-        if (!hasRoomForVariableEvent(&eventBuf, size)){
-            // Event size exceeds buffer size, bail out:
-            RELEASE_LOCK(&eventBufMutex);
-            return;
-        }
-    }
-
-    postEventHeader(&eventBuf, tag);
-    postPayloadSize(&eventBuf, size);
-    postCapsetID(&eventBuf, capset);
-
-    postBuf(&eventBuf, (StgWord8*) msg, strsize);
-
-    RELEASE_LOCK(&eventBufMutex);
+    endGlobalEvent(&ev);
 }
 
 void postCapsetVecEvent (EventTypeNum tag,
@@ -687,6 +1805,7 @@ void postCapsetVecEvent (EventTypeNum tag,
                          int argc,
                          char *argv[])
 {
+    GlobalEvent ev;
     int i, size = sizeof(EventCapsetID);
 
     for (i = 0; i < argc; i++) {
@@ -694,38 +1813,24 @@ void postCapsetVecEvent (EventTypeNum tag,
         size += 1 + strlen(argv[i]);
     }
 
-    ACQUIRE_LOCK(&eventBufMutex);
-
-    if (!hasRoomForVariableEvent(&eventBuf, size)){
-        printAndClearEventBuf(&eventBuf);
-
-        if(!hasRoomForVariableEvent(&eventBuf, size)){
-            // Event size exceeds buffer size, bail out:
-            RELEASE_LOCK(&eventBufMutex);
-            return;
-        }
-    }
-
-    postEventHeader(&eventBuf, tag);
-    postPayloadSize(&eventBuf, size);
-    postCapsetID(&eventBuf, capset);
+    beginGlobalEvent(&ev, tag, time_ns(), size);
+    postCapsetID(&ev.payload, capset);
 
     for( i = 0; i < argc; i++ ) {
         // again, 1 + to account for \0
-        postBuf(&eventBuf, (StgWord8*) argv[i], 1 + strlen(argv[i]));
+        postBuf(&ev.payload, (StgWord8*) argv[i], 1 + strlen(argv[i]));
     }
 
-    RELEASE_LOCK(&eventBufMutex);
+    endGlobalEvent(&ev);
 }
 
 void postWallClockTime (EventCapsetID capset)
 {
+    GlobalEvent ev;
     StgWord64 ts;
     StgWord64 sec;
     StgWord32 nsec;
 
-    ACQUIRE_LOCK(&eventBufMutex);
-    
     /* The EVENT_WALL_CLOCK_TIME event is intended to allow programs
        reading the eventlog to match up the event timestamps with wall
        clock time. The normal event timestamps measure time since the
@@ -745,22 +1850,15 @@ void postWallClockTime (EventCapsetID capset)
     getUnixEpochTime(&sec, &nsec);  /* Get the wall clock time */
     ts = time_ns();                 /* Get the eventlog timestamp */
 
-    if (!ensureRoomForEvent(&eventBuf, EVENT_WALL_CLOCK_TIME)) {
-        return;
-    }
+    beginGlobalEvent(&ev, EVENT_WALL_CLOCK_TIME, ts,
+                     eventTypes[EVENT_WALL_CLOCK_TIME].size);
 
-    /* Normally we'd call postEventHeader(), but that generates its own
-       timestamp, so we go one level lower so we can write out the
-       timestamp we already generated above. */
-    postEventTypeNum(&eventBuf, EVENT_WALL_CLOCK_TIME);
-    postWord64(&eventBuf, ts);
-    
     /* EVENT_WALL_CLOCK_TIME (capset, unix_epoch_seconds, nanoseconds) */
-    postCapsetID(&eventBuf, capset);
-    postWord64(&eventBuf, sec);
-    postWord32(&eventBuf, nsec);
+    postCapsetID(&ev.payload, capset);
+    postWord64(&ev.payload, sec);
+    postWord32(&ev.payload, nsec);
 
-    RELEASE_LOCK(&eventBufMutex);
+    endGlobalEvent(&ev);
 }
 
 void
@@ -801,9 +1899,19 @@ void postLogMsg(EventsBuf *eb, EventTypeNum type, char *msg, va_list ap)
 
 void postMsg(char *msg, va_list ap)
 {
-    ACQUIRE_LOCK(&eventBufMutex);
-    postLogMsg(&eventBuf, EVENT_LOG_MSG, msg, ap);
-    RELEASE_LOCK(&eventBufMutex);
+    GlobalEvent ev;
+    char buf[BUF];
+    nat size;
+
+    size = vsnprintf(buf,BUF,msg,ap);
+    if (size > BUF) {
+        buf[BUF-1] = '\0';
+        size = BUF;
+    }
+
+    beginGlobalEvent(&ev, EVENT_LOG_MSG, time_ns(), size);
+    postBuf(&ev.payload,(StgWord8*)buf,size);
+    endGlobalEvent(&ev);
 }
 
 void postCapMsg(Capability *cap, char *msg, va_list ap)
@@ -818,18 +1926,16 @@ void postUserMsg(Capability *cap, char *msg, va_list ap)
 
 void postModule(char *modName, StgWord32 modCount, StgWord32 modHashNo)
 {
+	GlobalEvent ev;
 	nat nameLen = strlen(modName);
 	nat size = nameLen + sizeof(modCount) + sizeof(modHashNo) + sizeof(StgWord32);
-	EventsBuf *eb = &eventBuf; // Should be safe without locking
-	if (!ensureRoomForVariableEvent(eb, size)) {
-		return;
-	}
-	postEventHeader(eb, EVENT_HPC_MODULE);
-	postPayloadSize(eb, size);
-    postBuf(eb,(StgWord8*)modName,nameLen);
-	postWord32(eb,modCount);
-	postWord32(eb,modHashNo);
-	postWord32(eb,0);
+
+	beginGlobalEvent(&ev, EVENT_HPC_MODULE, time_ns(), size);
+	postBuf(&ev.payload,(StgWord8*)modName,nameLen);
+	postWord32(&ev.payload,modCount);
+	postWord32(&ev.payload,modHashNo);
+	postWord32(&ev.payload,0);
+	endGlobalEvent(&ev);
 
 }
 
@@ -837,15 +1943,106 @@ void postInstrPtrSample(Capability *cap, StgBool own_cap, StgWord32 cnt, void **
 {
 	// (size:16, cap:16, cnt * (tick : 32, freq : 32) )
 	nat size = sizeof(EventCapNo) + cnt * sizeof(StgWord64), i;
-	EventsBuf *eb = own_cap ? &capEventBuf[cap->no] : &eventBuf;
+	GlobalEvent ev;
+	EventsBuf *eb;
+
+	if (own_cap) {
+		eb = &capEventBuf[cap->no];
+		if (!ensureRoomForVariableEvent(eb, size)) {
+			return;
+		}
+		postEventHeader(eb, EVENT_INSTR_PTR_SAMPLE);
+		postPayloadSize(eb, size);
+	} else {
+		// posted from another thread, e.g. the timer
+		beginGlobalEvent(&ev, EVENT_INSTR_PTR_SAMPLE, time_ns(), size);
+		eb = &ev.payload;
+	}
+	postCapNo(eb, cap->no);
+	for (i = 0; i < cnt; i++) {
+		postWord64(eb, (StgWord64) ips[i]);
+	}
+	if (!own_cap) {
+		endGlobalEvent(&ev);
+	}
+}
+
+void postPerfSample(Capability *cap, StgBool own_cap, StgWord16 counters,
+                    nat n_counters, StgWord32 cnt, StgWord64 *samples)
+{
+	// (size:16, cap:16, counters:16, cnt * (ip:64, n_counters * value:64))
+	nat sample_size = (1 + n_counters) * sizeof(StgWord64);
+	nat max_cnt = (0xffff - 2 * sizeof(StgWord16)) / sample_size;
+	nat n, size, i;
+	GlobalEvent ev;
+	EventsBuf *eb;
+
+	// Split up what doesn't fit into one event
+	for (; cnt > 0; cnt -= n, samples += n * (1 + n_counters)) {
+		n = cnt < max_cnt ? cnt : max_cnt;
+		size = 2 * sizeof(StgWord16) + n * sample_size;
+
+		if (own_cap) {
+			eb = &capEventBuf[cap->no];
+			if (!ensureRoomForVariableEvent(eb, size)) {
+				return;
+			}
+			postEventHeader(eb, EVENT_PERF_SAMPLE);
+			postPayloadSize(eb, size);
+		} else {
+			// posted from another thread, e.g. the timer
+			beginGlobalEvent(&ev, EVENT_PERF_SAMPLE, time_ns(), size);
+			eb = &ev.payload;
+		}
+		postCapNo(eb, cap->no);
+		postWord16(eb, counters);
+		for (i = 0; i < n * (1 + n_counters); i++) {
+			postWord64(eb, samples[i]);
+		}
+		if (!own_cap) {
+			endGlobalEvent(&ev);
+		}
+	}
+}
+
+void postStackSample(Capability *cap, EventThreadID thread,
+                     StgWord32 cnt, StgWord64 *frames)
+{
+	// (size:16, thread:32, cnt * frame:64)
+	nat size = sizeof(EventThreadID) + cnt * sizeof(StgWord64);
+	EventsBuf *eb = &capEventBuf[cap->no];
+	StgWord32 i;
+
 	if (!ensureRoomForVariableEvent(eb, size)) {
 		return;
 	}
-	postEventHeader(eb, EVENT_INSTR_PTR_SAMPLE);
+	postEventHeader(eb, EVENT_STACK_SAMPLE);
 	postPayloadSize(eb, size);
-	postCapNo(eb, cap->no);
+	postThreadID(eb, thread);
 	for (i = 0; i < cnt; i++) {
-		postWord64(eb, (StgWord64) ips[i]);
+		postWord64(eb, frames[i]);
+	}
+}
+
+void postInfoTableSamples(Capability *cap, StgWord32 cnt, StgWord64 *samples)
+{
+	// (size:16, cap:16, cnt * (info:64, samples:64))
+	nat max_cnt = (0xffff - sizeof(StgWord16)) / (2 * sizeof(StgWord64));
+	nat n, size, i;
+	GlobalEvent ev;
+
+	// Split up what doesn't fit into one event
+	for (; cnt > 0; cnt -= n, samples += 2 * n) {
+		n = cnt < max_cnt ? cnt : max_cnt;
+		size = sizeof(StgWord16) + n * 2 * sizeof(StgWord64);
+
+		// posted at exit, by whichever thread is shutting down
+		beginGlobalEvent(&ev, EVENT_INFO_TABLE_SAMPLES, time_ns(), size);
+		postCapNo(&ev.payload, cap->no);
+		for (i = 0; i < 2 * n; i++) {
+			postWord64(&ev.payload, samples[i]);
+		}
+		endGlobalEvent(&ev);
 	}
 }
 
@@ -864,87 +2061,88 @@ void postDebugData(EventTypeNum num, StgWord16 size, StgWord8 *dbg)
 		return;
 	}
 
-	EventsBuf *eb = &eventBuf; // Should be safe without locking
-
-	// Flush buffer if necessary
-	if (!ensureRoomForVariableEvent(eb, size)) {
-		return;
+	GlobalEvent ev;
+	EventsBuf *eb = &ev.payload;
+
+	beginGlobalEvent(&ev, num, time_ns(), size);
+
+	// Post data. In a compact block the fields of a fixed-size event
+	// must be re-encoded: the only such debug event is
+	// EVENT_DEBUG_PTR_RANGE, made of Word64s.
+	if (eb->compact_fields) {
+		nat i, j;
+		StgWord64 w;
+		for (i = 0; i + 8 <= size; i += 8) {
+			w = 0;
+			for (j = 0; j < 8; j++) {
+				w = (w << 8) | dbg[i+j];
+			}
+			postWord64(eb, w);
+		}
+	} else {
+		postBuf(eb, dbg, size);
 	}
-
-	// Post header
-	postEventHeader(eb, num);
-	if (spec_size == EVENT_SIZE_VARIABLE)
-		postPayloadSize(eb, size);
-
-	// Post data
-	postBuf(eb, dbg, size);
-	dbg += size;
-
+	endGlobalEvent(&ev);
 }
 
 void postDebugModule(char *mod_name)
 {
-	EventsBuf *eb = &eventBuf; // Should be safe without locking
-
-	// Check for flush
+	GlobalEvent ev;
 	nat size = strlen(mod_name) + 1;
-	if (!ensureRoomForVariableEvent(eb, size)) {
-		return;
-	}
 
-	// Write out
-	postEventHeader(eb, EVENT_DEBUG_MODULE);
-	postPayloadSize(eb, size);
-	postBuf(eb, (StgWord8 *)mod_name, (int) size);
+	beginGlobalEvent(&ev, EVENT_DEBUG_MODULE, time_ns(), size);
+	postBuf(&ev.payload, (StgWord8 *)mod_name, (int) size);
+	endGlobalEvent(&ev);
 
 }
 
 void postDebugProc(char *label)
 {
-	EventsBuf *eb = &eventBuf; // Should be safe without locking
-
-	// Check for flush
+	GlobalEvent ev;
 	nat size = sizeof(StgWord16) + sizeof(StgWord16) + strlen(label) + 1;
-	if (!ensureRoomForVariableEvent(eb, size)) {
-		return;
-	}
 
-	// Write out
-	postEventHeader(eb, EVENT_DEBUG_PROCEDURE);
-	postPayloadSize(eb, size);
-	postWord16(eb, (StgWord16)0xffff);
-	postWord16(eb, (StgWord16)0xffff);
-	postBuf(eb, (StgWord8 *)label, (int) strlen(label) + 1);
+	beginGlobalEvent(&ev, EVENT_DEBUG_PROCEDURE, time_ns(), size);
+	postWord16(&ev.payload, (StgWord16)0xffff);
+	postWord16(&ev.payload, (StgWord16)0xffff);
+	postBuf(&ev.payload, (StgWord8 *)label, (int) strlen(label) + 1);
+	endGlobalEvent(&ev);
 
 }
 
 void postProcPtrRange(void *low_pc, void * high_pc)
 {
-	EventsBuf *eb = &eventBuf; // Should be safe without locking
+	GlobalEvent ev;
 
-	if (!ensureRoomForEvent(&eventBuf, EVENT_DEBUG_PTR_RANGE)) {
-		return;
-	}
-
-	// Post data
-	postEventHeader(eb, EVENT_DEBUG_PTR_RANGE);
-	postWord64(eb, (StgWord64) low_pc);
-	postWord64(eb, (StgWord64) high_pc);
+	beginGlobalEvent(&ev, EVENT_DEBUG_PTR_RANGE, time_ns(),
+	                 eventTypes[EVENT_DEBUG_PTR_RANGE].size);
+	postWord64(&ev.payload, (StgWord64) low_pc);
+	postWord64(&ev.payload, (StgWord64) high_pc);
+	endGlobalEvent(&ev);
 }
 
-void postEventStartup(EventCapNo n_caps)
+void postProcSamples(StgWord32 cnt, void **procs, StgWord64 *samples)
 {
-    ACQUIRE_LOCK(&eventBufMutex);
+	// (size:16, cnt * (proc : 64, samples : 64))
+	nat size = cnt * 2 * sizeof(StgWord64), i;
+	GlobalEvent ev;
 
-	if (!ensureRoomForEvent(&eventBuf, EVENT_STARTUP)) {
-		return;
+	beginGlobalEvent(&ev, EVENT_PROC_SAMPLES, time_ns(), size);
+	for (i = 0; i < cnt; i++) {
+		postWord64(&ev.payload, (StgWord64) procs[i]);
+		postWord64(&ev.payload, samples[i]);
 	}
+	endGlobalEvent(&ev);
+}
 
-    // Post a STARTUP event with the number of capabilities
-    postEventHeader(&eventBuf, EVENT_STARTUP);
-    postCapNo(&eventBuf, n_caps);
+void postEventStartup(EventCapNo n_caps)
+{
+    GlobalEvent ev;
 
-    RELEASE_LOCK(&eventBufMutex);
+    // Post a STARTUP event with the number of capabilities
+    beginGlobalEvent(&ev, EVENT_STARTUP, time_ns(),
+                     eventTypes[EVENT_STARTUP].size);
+    postCapNo(&ev.payload, n_caps);
+    endGlobalEvent(&ev);
 }
 
 void postThreadLabel(Capability    *cap,
@@ -971,6 +2169,8 @@ void closeBlockMarker (EventsBuf *ebuf)
 {
     StgInt8* save_pos;
 
+    closeCompactEvent(ebuf);
+
     if (ebuf->marker)
     {
         // (type:16, time:64, size:32, end_time:64)
@@ -978,8 +2178,8 @@ void closeBlockMarker (EventsBuf *ebuf)
         save_pos = ebuf->pos;
         ebuf->pos = ebuf->marker + sizeof(EventTypeNum) +
                     sizeof(EventTimestamp);
-        postWord32(ebuf, save_pos - ebuf->marker);
-        postTimestamp(ebuf);
+        postRawWord32(ebuf, save_pos - ebuf->marker);
+        postRawWord64(ebuf, eventTime(ebuf));
         ebuf->pos = save_pos;
         ebuf->marker = NULL;
     }
@@ -994,29 +2194,44 @@ void postBlockMarker (EventsBuf *eb)
 
     closeBlockMarker(eb);
 
+    // never compact, so that readers can skip whole blocks
     eb->marker = eb->pos;
-    postEventHeader(eb, EVENT_BLOCK_MARKER);
-    postWord32(eb,0); // these get filled in later by closeBlockMarker();
-    postWord64(eb,0);
-    postCapNo(eb, eb->capno);
+    eb->block_time = time_ns();
+#ifdef HAVE_EVENTLOG_TSC
+    if (event_log_tsc) {
+        eb->block_tsc = readTSC();
+    }
+#endif
+    postRawWord16(eb, EVENT_BLOCK_MARKER);
+    postRawWord64(eb, eb->block_time);
+    postRawWord32(eb,0); // these get filled in later by closeBlockMarker();
+    postRawWord64(eb,0);
+    postRawWord16(eb, eb->capno);
 }
 
-void printAndClearEventBuf (EventsBuf *ebuf)
+// Write out ebuf, or move it on in its ring, and start a new block.  If
+// the block can't be written it is dropped, and rtsFalse is returned.
+StgBool printAndClearEventBuf (EventsBuf *ebuf)
 {
-    StgWord64 numBytes = 0, written = 0;
+    StgWord64 numBytes = 0;
+    StgBool ok = rtsTrue;
 
     closeBlockMarker(ebuf);
 
     if (ebuf->begin != NULL && ebuf->pos != ebuf->begin)
     {
         numBytes = ebuf->pos - ebuf->begin;
-        
-        written = fwrite(ebuf->begin, 1, numBytes, event_log_file);
-        if (written != numBytes) {
-            debugBelch(
-                "printAndClearEventLog: fwrite() failed, written=%" FMT_Word64
-                " doesn't match numBytes=%" FMT_Word64, written, numBytes);
-            return;
+
+        if (ebuf->ring != NULL) {
+            ebuf->begin = rotateEventsRing(ebuf->ring, numBytes);
+        }
+#ifdef THREADED_RTS
+        else if (writer_running) {
+            ebuf->begin = handOffEventsBuf(ebuf->begin, numBytes);
+        }
+#endif
+        else {
+            ok = writeEventBlock(ebuf->begin, numBytes);
         }
         
         resetEventsBuf(ebuf);
@@ -1024,6 +2239,346 @@ void printAndClearEventBuf (EventsBuf *ebuf)
 
         postBlockMarker(ebuf);
     }
+    return ok;
+}
+
+/* -----------------------------------------------------------------------------
+   Flight recorder
+   -------------------------------------------------------------------------- */
+
+void initEventsRing(EventsBuf *eb, StgWord64 ring_size,
+                    nat max_pinned, EventCapNo capno)
+{
+    EventsRing *ring;
+    nat i;
+
+    initEventsBuf(eb, EVENT_RING_BLOCK_SIZE, capno);
+
+    ring = stgMallocBytes(sizeof(EventsRing), "initEventsRing");
+    // <size> bytes, plus the block that a dump moves on to
+    ring->n_blocks = ring_size / EVENT_RING_BLOCK_SIZE + 1;
+    if (ring->n_blocks < 2) {
+        ring->n_blocks = 2;
+    }
+    ring->blocks = stgMallocBytes(ring->n_blocks * sizeof(StgInt8 *),
+                                  "initEventsRing");
+    ring->used = stgMallocBytes(ring->n_blocks * sizeof(StgWord64),
+                                "initEventsRing");
+    ring->blocks[0] = eb->begin;
+    ring->used[0] = 0;
+    for (i = 1; i < ring->n_blocks; i++) {
+        ring->blocks[i] = stgMallocBytes(EVENT_RING_BLOCK_SIZE,
+                                         "initEventsRing");
+        ring->used[i] = 0;
+    }
+    ring->cur = 0;
+
+    ring->n_pinned = 0;
+    ring->max_pinned = max_pinned;
+    if (max_pinned > 0) {
+        ring->pinned = stgMallocBytes(max_pinned * sizeof(StgInt8 *),
+                                      "initEventsRing");
+        ring->pinned_used = stgMallocBytes(max_pinned * sizeof(StgWord64),
+                                           "initEventsRing");
+    } else {
+        ring->pinned = NULL;
+        ring->pinned_used = NULL;
+    }
+
+    eb->ring = ring;
+}
+
+void freeEventsRing(EventsBuf *eb)
+{
+    EventsRing *ring = eb->ring;
+    nat i;
+
+    for (i = 0; i < ring->n_blocks; i++) {
+        stgFree(ring->blocks[i]);
+    }
+    for (i = 0; i < ring->n_pinned; i++) {
+        stgFree(ring->pinned[i]);
+    }
+    stgFree(ring->blocks);
+    stgFree(ring->used);
+    if (ring->pinned != NULL) {
+        stgFree(ring->pinned);
+        stgFree(ring->pinned_used);
+    }
+    stgFree(ring);
+
+    eb->ring = NULL;
+    eb->begin = eb->pos = eb->marker = NULL;
+}
+
+// The current block is full (size bytes): keep it, and return the
+// block to carry on logging into.
+StgInt8 *rotateEventsRing(EventsRing *ring, StgWord64 size)
+{
+    if (ring->n_pinned < ring->max_pinned) {
+        ring->pinned[ring->n_pinned] = ring->blocks[ring->cur];
+        ring->pinned_used[ring->n_pinned] = size;
+        ring->n_pinned++;
+        ring->blocks[ring->cur] = stgMallocBytes(EVENT_RING_BLOCK_SIZE,
+                                                 "rotateEventsRing");
+    } else {
+        ring->used[ring->cur] = size;
+        ring->cur = (ring->cur + 1) % ring->n_blocks;
+        ring->used[ring->cur] = 0;
+    }
+    return ring->blocks[ring->cur];
+}
+
+// Write out the filled blocks of a ring, oldest first.  The current
+// block is left out: it only holds an open block marker.
+void writeEventsRing(EventsRing *ring)
+{
+    nat i, slot;
+
+    for (i = 0; i < ring->n_pinned; i++) {
+        if (!writeEventLog(ring->pinned[i], ring->pinned_used[i])) {
+            return;
+        }
+    }
+    for (i = 1; i < ring->n_blocks; i++) {
+        slot = (ring->cur + i) % ring->n_blocks;
+        if (ring->used[slot] != 0) {
+            if (!writeEventLog(ring->blocks[slot], ring->used[slot])) {
+                return;
+            }
+        }
+    }
+}
+
+// Write the contents of all rings to the sink as a complete eventlog.
+// The caller must own all capabilities, have sealed eventBuf, and hold
+// sink_mutex.
+void dumpEventLogRings(void)
+{
+    StgInt8 end[sizeof(EventTypeNum)];
+    EventsBuf eb;
+    nat c;
+
+    // Close the blocks being filled, so that they are part of the dump.
+    for (c = 0; c < n_capabilities; ++c) {
+        printAndClearEventBuf(&capEventBuf[c]);
+    }
+    printAndClearEventBuf(&eventBuf);
+
+    writeEventLog(event_log_header, event_log_header_size);
+    writeEventsRing(eventBuf.ring);
+    for (c = 0; c < n_capabilities; ++c) {
+        writeEventsRing(capEventBuf[c].ring);
+    }
+
+    eb.begin = eb.pos = end;
+    eb.marker = NULL;
+    eb.size = sizeof(end);
+    eb.capno = (EventCapNo)(-1);
+    eb.ring = NULL;
+    eb.compact_len = NULL;
+    eb.compact_fields = rtsFalse;
+    postEventTypeNum(&eb, EVENT_DATA_END);
+    writeEventLog(end, sizeof(end));
+}
+
+// May be called from a signal handler.
+void requestEventLogDump(void)
+{
+    eventlog_dump_requested = 1;
+}
+
+void dumpRequestedEventLog(void)
+{
+    EventLogSink sink;
+    char *filename;
+    FILE *f;
+    nat len;
+
+    if (!eventlog_dump_requested || eventBuf.ring == NULL) {
+        return;
+    }
+    eventlog_dump_requested = 0;
+
+    // <prog>.eventlog becomes <prog>.flight-<n>.eventlog
+    len = strlen(event_log_filename) - strlen(".eventlog");
+    filename = stgMallocBytes(len + 10 /* .flight- */
+                                  + 10 /* %u */
+                                  + 10 /* .eventlog */,
+                              "dumpRequestedEventLog");
+    sprintf(filename, "%.*s.flight-%u.eventlog",
+            (int)len, event_log_filename, ++ring_dumps);
+
+    // These always go to a file of their own: a stream of several
+    // complete eventlogs would not make sense to a reader.
+    if ((f = fopen(filename, "wb")) == NULL) {
+        sysErrorBelch("dumpEventLog: can't open %s", filename);
+    } else {
+        ACQUIRE_LOCK(&sink_mutex);
+        sink = event_log_sink;
+        setFileSink(f);
+        event_log_sink_open = rtsTrue;
+        sealGlobalEventsBuf();
+        dumpEventLogRings();
+        unsealGlobalEventsBuf();
+        closeEventLogSink(); // unless a failed write closed it already
+        event_log_sink = sink;
+        RELEASE_LOCK(&sink_mutex);
+    }
+
+    stgFree(filename);
+}
+
+static StgWord64 getRawWord(StgInt8 *p, nat bytes)
+{
+    StgWord64 w = 0;
+    nat i;
+
+    for (i = 0; i < bytes; i++) {
+        w = (w << 8) | (StgWord8)p[i];
+    }
+    return w;
+}
+
+// Remember where the block starting at data goes, if it is a block
+// (the header isn't).
+static void addEventLogIndexEntry(StgInt8 *data, StgWord64 size)
+{
+    IndexEntry *e;
+
+    // (type:16, time:64, size:32, end_time:64, capno:16)
+    if (size < 24 || getRawWord(data, 2) != EVENT_BLOCK_MARKER) {
+        return;
+    }
+
+    if (index_len == index_size) {
+        index_size = index_size == 0 ? 1024 : index_size * 2;
+        index_entries = stgReallocBytes(index_entries,
+                                        index_size * sizeof(IndexEntry),
+                                        "addEventLogIndexEntry");
+    }
+    e = &index_entries[index_len++];
+    e->offset = segment_bytes;
+    e->start  = getRawWord(data + 2, 8);
+    e->end    = getRawWord(data + 14, 8);
+    e->capno  = (EventCapNo)getRawWord(data + 22, 2);
+}
+
+static void writeEventLogIndex(void)
+{
+    EventsBuf eb;
+    StgWord64 size;
+    nat i;
+
+    // A failed write may have left part of a block in the file, so we
+    // don't know where the later blocks went.
+    if (segment_broken) {
+        index_len = 0;
+        return;
+    }
+
+    size = 4 + 4 + index_len * (8 + 2 + 8 + 8) + 8 + 4;
+    eb.begin = eb.pos = stgMallocBytes(size, "writeEventLogIndex");
+
+    postRawWord32(&eb, EVENT_INDEX_BEGIN);
+    postRawWord32(&eb, index_len);
+    for (i = 0; i < index_len; i++) {
+        postRawWord64(&eb, index_entries[i].offset);
+        postRawWord16(&eb, index_entries[i].capno);
+        postRawWord64(&eb, index_entries[i].start);
+        postRawWord64(&eb, index_entries[i].end);
+    }
+    postRawWord64(&eb, segment_bytes);
+    postRawWord32(&eb, EVENT_INDEX_END);
+
+    if (writeEventLog(eb.begin, size)) {
+        segment_bytes += size;
+    }
+    index_len = 0;
+    stgFree(eb.begin);
+}
+
+// Write the end of data marker, then the index of the file if any.
+void finishEventLogFile(void)
+{
+    StgInt8 end[sizeof(EventTypeNum)];
+    EventsBuf eb;
+
+    eb.begin = eb.pos = end;
+    eb.compact_fields = rtsFalse;
+    postEventTypeNum(&eb, EVENT_DATA_END);
+    if (writeEventLog(end, sizeof(end))) {
+        segment_bytes += sizeof(end);
+    } else {
+        segment_broken = rtsTrue;
+    }
+
+    if (event_log_index) {
+        writeEventLogIndex();
+    }
+}
+
+// Finish the current segment and start the next one.  If the next file
+// can't be opened, we carry on with the current one.
+static void rotateEventLog(void)
+{
+    FILE *f;
+
+    sprintf(event_log_filename, "%s.%u.eventlog",
+            event_log_stem, event_log_seq + 1);
+    if ((f = fopen(event_log_filename, "wb")) == NULL) {
+        sysErrorBelch("eventlog: can't open %s, not rotating any more",
+                      event_log_filename);
+        event_log_rotate = rtsFalse;
+        return;
+    }
+
+    finishEventLogFile();
+    closeEventLogSink();
+
+    event_log_file = f;
+    setFileSink(f);
+    event_log_sink_open = rtsTrue;
+    event_log_seq++;
+
+    segment_broken = !writeEventLog(event_log_header, event_log_header_size);
+    segment_bytes = segment_broken ? 0 : event_log_header_size;
+    segment_start = stat_getElapsedTime();
+}
+
+// Write out a complete block, first starting a new segment if the
+// current one is full.
+StgBool writeEventBlock(void *data, StgWord64 size)
+{
+    StgBool ok;
+
+    ACQUIRE_LOCK(&sink_mutex);
+    if (!track_blocks) {
+        ok = writeEventLog(data, size);
+        RELEASE_LOCK(&sink_mutex);
+        return ok;
+    }
+
+    if (event_log_rotate && segment_bytes > event_log_header_size &&
+        ((RtsFlags.TraceFlags.rotateSize != 0 &&
+          segment_bytes + size > RtsFlags.TraceFlags.rotateSize) ||
+         (RtsFlags.TraceFlags.rotateTime != 0 &&
+          stat_getElapsedTime() - segment_start >=
+              RtsFlags.TraceFlags.rotateTime))) {
+        rotateEventLog();
+    }
+    if (event_log_index) {
+        addEventLogIndexEntry(data, size);
+    }
+    ok = writeEventLog(data, size);
+    if (ok) {
+        segment_bytes += size;
+    } else {
+        segment_broken = rtsTrue;
+    }
+    RELEASE_LOCK(&sink_mutex);
+
+    return ok;
 }
 
 void initEventsBuf(EventsBuf* eb, StgWord64 size, EventCapNo capno)
@@ -1032,12 +2587,202 @@ void initEventsBuf(EventsBuf* eb, StgWord64 size, EventCapNo capno)
     eb->size = size;
     eb->marker = NULL;
     eb->capno = capno;
+    eb->ring = NULL;
+    eb->block_time = 0;
+    eb->block_tsc = 0;
+    eb->compact_len = NULL;
+    eb->compact_fields = rtsFalse;
 }
 
 void resetEventsBuf(EventsBuf* eb)
 {
     eb->pos = eb->begin;
     eb->marker = NULL;
+    eb->compact_len = NULL;
+    eb->compact_fields = rtsFalse;
+}
+
+/* -----------------------------------------------------------------------------
+   Posting to the global event buffer (see the comment at eventBufState)
+   -------------------------------------------------------------------------- */
+
+static void waitForGlobalEventsBuf(void)
+{
+#ifdef THREADED_RTS
+    yieldThread();
+#endif
+}
+
+void beginGlobalEvent(GlobalEvent *ev, EventTypeNum type,
+                      StgWord64 time, nat payload_bytes)
+{
+    StgWord64 size;
+
+    ev->type = type;
+    ev->time = time;
+    ev->variable = eventTypes[type].size == EVENT_SIZE_VARIABLE;
+
+    // Safety - messages of this size can't be printed at all because
+    // there's no way to write their length in 16 bits.
+    if (ev->variable && payload_bytes > (1 << 16)) {
+        barf("Oversized event of size %d had to be dropped!", payload_bytes);
+    }
+
+    // ULEB128 takes at most 3 bytes per Word16
+    size = payload_bytes + payload_bytes / 2;
+    if (size <= sizeof(ev->small)) {
+        ev->payload.begin = ev->small;
+    } else {
+        ev->payload.begin = stgMallocBytes(size, "beginGlobalEvent");
+    }
+    ev->payload.pos = ev->payload.begin;
+    ev->payload.size = size;
+    ev->payload.marker = NULL;
+    ev->payload.capno = (EventCapNo)(-1);
+    ev->payload.ring = NULL;
+    ev->payload.block_time = 0;
+    ev->payload.block_tsc = 0;
+    ev->payload.compact_len = NULL;
+    ev->payload.compact_fields = event_log_compact && !ev->variable;
+}
+
+// Encode the header of ev, for a block started at block_time.
+static nat encodeGlobalEventHeader(GlobalEvent *ev, StgWord64 block_time,
+                                   StgInt8 *hdr)
+{
+    EventsBuf eb;
+    StgWord64 len;
+
+    eb.begin = eb.pos = hdr;
+    eb.compact_fields = rtsFalse;
+    len = ev->payload.pos - ev->payload.begin;
+
+    if (event_log_compact) {
+        postULEB128(&eb, ev->type);
+        postULEB128(&eb, ev->time > block_time ? ev->time - block_time : 0);
+        postULEB128(&eb, len);
+    } else {
+        postRawWord16(&eb, ev->type);
+        postRawWord64(&eb, ev->time);
+        if (ev->variable) {
+            postRawWord16(&eb, len);
+        }
+    }
+    return eb.pos - eb.begin;
+}
+
+// Wait until the space reserved in eventBuf up to off has been filled in.
+// Without threads there is never anything to wait for (see eventBufBusy).
+static void waitForGlobalEventsCommitted(StgWord off)
+{
+    while (VOLATILE_LOAD(&eventBufCommitted) != off) {
+#ifdef THREADED_RTS
+        busy_wait_nop();
+#endif
+    }
+    eventBuf.pos = eventBuf.begin + off;
+}
+
+void endGlobalEvent(GlobalEvent *ev)
+{
+    StgInt8 hdr[16];
+    StgWord st, off, len, c;
+    nat hdr_len;
+    StgBool ok;
+
+    len = ev->payload.pos - ev->payload.begin;
+
+#ifndef THREADED_RTS
+    if (eventBufBusy) {
+        goto dropped;
+    }
+    eventBufBusy = 1;
+#endif
+
+    for (;;) {
+        st = VOLATILE_LOAD(&eventBufState);
+        if (st & GLOBAL_SEALED) {
+#ifdef THREADED_RTS
+            if (!eventBufClosed) {
+                waitForGlobalEventsBuf();
+                continue;
+            }
+#endif
+            // the eventlog has ended, or (without threads) is being
+            // flushed by the code we interrupted: drop the event
+            goto done;
+        }
+        // block_time is published before eventBufState
+        load_load_barrier();
+        hdr_len = encodeGlobalEventHeader(ev, eventBuf.block_time, hdr);
+        off = st & GLOBAL_OFFSET_MASK;
+
+        if (off + hdr_len + len > eventBuf.size) {
+            // No room: flush the buffer, unless another writer got
+            // there first.  The buffer is empty afterwards even if the
+            // sink failed, but then we drop the event rather than
+            // trying again.
+            if (cas(&eventBufState, st, st | GLOBAL_SEALED) != st) {
+                continue;
+            }
+            waitForGlobalEventsCommitted(off);
+            ok = printAndClearEventBuf(&eventBuf);
+            unsealGlobalEventsBuf();
+            if (!ok) goto done;
+            continue;
+        }
+
+        if (cas(&eventBufState, st, st + hdr_len + len) == st) {
+            break;
+        }
+    }
+
+    memcpy(eventBuf.begin + off, hdr, hdr_len);
+    memcpy(eventBuf.begin + off + hdr_len, ev->payload.begin, len);
+
+    do {
+        c = VOLATILE_LOAD(&eventBufCommitted);
+    } while (cas(&eventBufCommitted, c, c + hdr_len + len) != c);
+
+done:
+#ifndef THREADED_RTS
+    eventBufBusy = 0;
+dropped:
+#endif
+    if (ev->payload.begin != ev->small) {
+        stgFree(ev->payload.begin);
+    }
+}
+
+// Take eventBuf for ourselves: no other writer can touch it until
+// unsealGlobalEventsBuf(), and eventBuf.pos is valid.
+void sealGlobalEventsBuf(void)
+{
+    StgWord st;
+
+    for (;;) {
+        st = VOLATILE_LOAD(&eventBufState);
+        if (!(st & GLOBAL_SEALED) &&
+            cas(&eventBufState, st, st | GLOBAL_SEALED) == st) {
+            break;
+        }
+        waitForGlobalEventsBuf();
+    }
+    waitForGlobalEventsCommitted(st & GLOBAL_OFFSET_MASK);
+}
+
+// Publish the contents of eventBuf (up to eventBuf.pos) to writers,
+// under a new generation.
+void unsealGlobalEventsBuf(void)
+{
+    StgWord off, gen;
+
+    ASSERT(eventBuf.pos - eventBuf.begin <= (StgInt64)GLOBAL_OFFSET_MASK);
+    off = eventBuf.pos - eventBuf.begin;
+    gen = (eventBufState >> GLOBAL_GEN_SHIFT) + 1;
+    eventBufCommitted = off;
+    write_barrier();
+    eventBufState = (gen << GLOBAL_GEN_SHIFT) | off;
 }
 
 StgBool hasRoomForEvent(EventsBuf *eb, EventTypeNum eNum)
@@ -1045,6 +2790,9 @@ StgBool hasRoomForEvent(EventsBuf *eb, EventTypeNum eNum)
   nat size;
 
   size = sizeof(EventTypeNum) + sizeof(EventTimestamp) + eventTypes[eNum].size;
+  if (event_log_compact) {
+      size += size / 2; // ULEB128 takes at most 3 bytes per Word16
+  }
 
   if (eb->pos + size > eb->begin + eb->size) {
       return 0; // Not enough space.
@@ -1059,6 +2807,9 @@ StgBool hasRoomForVariableEvent(EventsBuf *eb, nat payload_bytes)
 
   size = sizeof(EventTypeNum) + sizeof(EventTimestamp) +
       sizeof(EventPayloadSize) + payload_bytes;
+  if (event_log_compact) {
+      size += size / 2;
+  }
 
   if (eb->pos + size > eb->begin + eb->size) {
       return 0; // Not enough space.
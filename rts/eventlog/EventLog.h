@@ -28,6 +28,29 @@ void abortEventLogging(void); // #4512 - after fork child needs to abort
 void flushEventLog(void);     // event log inherited from parent
 void moreCapEventBufs (nat from, nat to);
 
+// Called by rts_setEventLogSink(), before initEventLogging()
+void setEventLogSink(const EventLogSink *sink);
+
+/*
+ * Flight recorder (+RTS --eventlog-ring): ask for the in-memory events
+ * to be written out (safe to call from a signal handler), and do so if
+ * asked.  dumpRequestedEventLog() must be called with all capabilities
+ * stopped.
+ */
+void requestEventLogDump(void);
+void dumpRequestedEventLog(void);
+
+#ifdef THREADED_RTS
+/*
+ * Counters of the background eventlog writer (+RTS --eventlog-async):
+ * buffers written, times a capability had to wait for a spare buffer,
+ * and buffers lost to write errors.
+ */
+void getEventLogWriterStats(StgWord64 *written,
+                            StgWord64 *blocked,
+                            StgWord64 *dropped);
+#endif
+
 /* 
  * Post a scheduler event to the capability's event buffer (an event
  * that has an associated thread).
@@ -84,6 +107,65 @@ void postSparkCountersEvent (Capability *cap,
                              SparkCounters counters,
                              StgWord remaining);
 
+/*
+ * Post the statistics of a GC, of each generation after it, and of
+ * each GC thread (all sizes in bytes).
+ */
+void postGcStatsEvent (Capability *cap,
+                       StgWord16   gen,
+                       StgWord64   alloc,
+                       StgWord64   copied,
+                       StgWord64   live,
+                       StgWord64   slop,
+                       StgWord16   par_n_threads,
+                       StgWord64   par_max_copied,
+                       StgWord64   par_tot_copied);
+
+void postGcGenStatsEvent (Capability *cap,
+                          StgWord16   gen,
+                          StgWord64   size,
+                          StgWord64   live,
+                          StgWord64   slop,
+                          StgWord64   large);
+
+void postGcThreadStatsEvent (Capability *cap,
+                             StgWord16   gc_thread,
+                             StgWord64   copied,
+                             StgWord64   scanned,
+                             StgWord64   any_work,
+                             StgWord64   no_work,
+                             StgWord64   scav_find_work);
+
+void postGcPhaseCountersEvent (Capability *cap,
+                               StgWord16   gc_thread,
+                               StgWord16   phase,
+                               StgWord64   cache_misses,
+                               StgWord64   dtlb_misses);
+
+void postThreadCountersEvent (Capability    *cap,
+                              EventThreadID  thread,
+                              StgWord64      cycles,
+                              StgWord64      instructions,
+                              StgWord64      cache_misses);
+
+/*
+ * Post a thread blocking on a black hole or an MVar, and being woken up
+ * again.  The events go to the buffer of the capability doing the work,
+ * which isn't necessarily thread_cap.
+ */
+void postThreadBlockedEvent (Capability    *cap,
+                             EventThreadID  thread,
+                             StgWord16      reason,
+                             StgWord64      object,
+                             EventThreadID  owner,
+                             EventCapNo     thread_cap);
+
+void postThreadUnblockedEvent (Capability    *cap,
+                               EventThreadID  thread,
+                               StgWord64      object,
+                               EventThreadID  waker,
+                               EventCapNo     thread_cap);
+
 /*
  * Profiling
  */
@@ -91,12 +173,18 @@ void postSparkCountersEvent (Capability *cap,
 void postModule(char *modName, StgWord32 modCount, StgWord32 modHashNo);
 
 void postInstrPtrSample(Capability *cap, StgBool own_cap, StgWord32 cnt, void **ips);
+void postPerfSample(Capability *cap, StgBool own_cap, StgWord16 counters,
+                    nat n_counters, StgWord32 cnt, StgWord64 *samples);
+void postStackSample(Capability *cap, EventThreadID thread,
+                     StgWord32 cnt, StgWord64 *frames);
+void postInfoTableSamples(Capability *cap, StgWord32 cnt, StgWord64 *samples);
 
 void postDebugData(EventTypeNum num, StgWord16 size, StgWord8 *dbg);
 
 void postDebugModule(char *unit_name);
 void postDebugProc(char *label);
 void postProcPtrRange(void *low_pc, void *high_pc);
+void postProcSamples(StgWord32 cnt, void **procs, StgWord64 *samples);
 
 /*
  * Post an event to annotate a thread with a label
@@ -294,6 +294,36 @@ setThreadAffinity (nat n GNUC3_ATTRIBUTE(__unused__),
 }
 #endif
 
+// The physical package (socket) CPU cpu is on. The CPUs of a package
+// share the last level cache, and usually a NUMA node. 0 if we can't
+// tell.
+#if defined(linux_HOST_OS)
+nat
+getProcessorPackage (nat cpu)
+{
+    char path[80];
+    FILE *f;
+    int package = 0;
+
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%u/topology/physical_package_id", cpu);
+    f = fopen(path, "r");
+    if (f != NULL) {
+        if (fscanf(f, "%d", &package) != 1 || package < 0) {
+            package = 0;
+        }
+        fclose(f);
+    }
+    return package;
+}
+#else
+nat
+getProcessorPackage (nat cpu GNUC3_ATTRIBUTE(__unused__))
+{
+    return 0;
+}
+#endif
+
 void
 interruptOSThread (OSThreadId id)
 {
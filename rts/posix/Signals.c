@@ -16,6 +16,10 @@
 #include "Prelude.h"
 #include "Stable.h"
 
+#ifdef TRACING
+#include "eventlog/EventLog.h"
+#endif
+
 #ifdef alpha_HOST_ARCH
 # if defined(linux_HOST_OS)
 #  include <asm/fpu.h>
@@ -482,6 +486,18 @@ empty_handler (int sig STG_UNUSED)
     // nothing
 }
 
+#ifdef TRACING
+/* -----------------------------------------------------------------------------
+ * SIGUSR2 handler, installed in eventlog flight recorder mode
+ * (+RTS --eventlog-ring): write out the recent events at the next GC.
+ * -------------------------------------------------------------------------- */
+static void
+eventlog_dump_handler (int sig STG_UNUSED)
+{
+    requestEventLogDump();
+}
+#endif
+
 /* -----------------------------------------------------------------------------
    SIGTSTP handling
 
@@ -616,6 +632,17 @@ initDefaultHandlers(void)
 	sysErrorBelch("warning: failed to install SIGPIPE handler");
     }
 
+#ifdef TRACING
+    if (RtsFlags.TraceFlags.ringSize != 0) {
+        action.sa_handler = eventlog_dump_handler;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        if (sigaction(SIGUSR2, &action, &oact) != 0) {
+            sysErrorBelch("warning: failed to install SIGUSR2 handler");
+        }
+    }
+#endif
+
     set_sigtstp_action(rtsTrue);
 }
 
@@ -636,6 +663,13 @@ resetDefaultHandlers(void)
     if (sigaction(SIGPIPE, &action, NULL) != 0) {
 	sysErrorBelch("warning: failed to uninstall SIGPIPE handler");
     }
+#ifdef TRACING
+    // restore SIGUSR2
+    if (RtsFlags.TraceFlags.ringSize != 0 &&
+        sigaction(SIGUSR2, &action, NULL) != 0) {
+	sysErrorBelch("warning: failed to uninstall SIGUSR2 handler");
+    }
+#endif
 
     set_sigtstp_action(rtsFalse);
 }
@@ -36,6 +36,7 @@
 #include "LdvProfile.h"
 #include "RaiseAsync.h"
 #include "Papi.h"
+#include "PerfEvent.h"
 #include "Stable.h"
 
 #include "GC.h"
@@ -209,6 +210,7 @@ GarbageCollect (rtsBool force_major_gc,
 
   // tell the stats department that we've started a GC 
   stat_startGC(gct);
+  perf_event_gc_start(gct);
 
   // lock the StablePtr table
   stablePtrPreGC();
@@ -323,6 +325,7 @@ GarbageCollect (rtsBool force_major_gc,
   wakeup_gc_threads(gct->thread_index);
 
   traceEventGcWork(gct->cap);
+  perf_event_gc_phase(gct, GC_PHASE_ROOTS);
 
   // scavenge the capability-private mutable lists.  This isn't part
   // of markSomeCapabilities() because markSomeCapabilities() can only
@@ -375,12 +378,14 @@ GarbageCollect (rtsBool force_major_gc,
    */
   for (;;)
   {
+      perf_event_gc_phase(gct, GC_PHASE_SCAVENGE);
       scavenge_until_all_done();
       // The other threads are now stopped.  We might recurse back to
       // here, but from now on this is the only thread.
       
       // must be last...  invariant is that everything is fully
       // scavenged at this point.
+      perf_event_gc_phase(gct, GC_PHASE_WEAK);
       if (traverseWeakPtrList()) { // returns rtsTrue if evaced something 
 	  inc_running();
 	  continue;
@@ -389,9 +394,18 @@ GarbageCollect (rtsBool force_major_gc,
       // If we get to here, there's really nothing left to do.
       break;
   }
+  perf_event_gc_phase(gct, GC_PHASE_OTHER);
 
   shutdown_gc_threads(gct->thread_index);
 
+  // Nobody is stealing from the todo_qs any more, so the arrays they
+  // have grown out of can go.
+  for (n = 0; n < n_capabilities; n++) {
+      for (g = 0; g < RtsFlags.GcFlags.generations; g++) {
+          freeRetiredWSDeque(gc_threads[n]->gens[g].todo_q);
+      }
+  }
+
   // Now see which stable names are still alive.
   gcStablePtrTable();
 
@@ -420,10 +434,12 @@ GarbageCollect (rtsBool force_major_gc,
 
   // Finally: compact or sweep the oldest generation.
   if (major_gc && oldest_gen->mark) {
+      perf_event_gc_phase(gct, GC_PHASE_COMPACT);
       if (oldest_gen->compact) 
           compact(gct->scavenged_static_objects);
       else
           sweep(oldest_gen);
+      perf_event_gc_phase(gct, GC_PHASE_OTHER);
   }
 
   copied = 0;
@@ -614,11 +630,13 @@ GarbageCollect (rtsBool force_major_gc,
   }
 
   // Reset the nursery: make the blocks empty
+  perf_event_gc_phase(gct, GC_PHASE_NURSERY);
   allocated += clearNurseries();
 
   resize_nursery();
 
   resetNurseries();
+  perf_event_gc_phase(gct, GC_PHASE_OTHER);
 
  // mark the garbage collected CAFs as dead
 #if 0 && defined(DEBUG) // doesn't work at the moment 
@@ -721,6 +739,7 @@ GarbageCollect (rtsBool force_major_gc,
 #endif
 
   // ok, GC over: tell the stats department what happened. 
+  perf_event_gc_end(gct);
   stat_endGC(gct, allocated, live_words,
              copied, N, max_copied, avg_copied,
              live_blocks * BLOCK_SIZE_W - live_words /* slop */);
@@ -817,6 +836,10 @@ new_gc_thread (nat n, gc_thread *t)
     t->papi_events = -1;
 #endif
 
+#ifdef USE_PERF_EVENT
+    memset(t->gc_phase_totals, 0, sizeof(t->gc_phase_totals));
+#endif
+
     for (g = 0; g < RtsFlags.GcFlags.generations; g++)
     {
         ws = &t->gens[g];
@@ -840,8 +863,6 @@ new_gc_thread (nat n, gc_thread *t)
         }
 
         ws->todo_q = newWSDeque(128);
-        ws->todo_overflow = NULL;
-        ws->n_todo_overflow = 0;
         ws->todo_large_objects = NULL;
 
         ws->part_list = NULL;
@@ -959,7 +980,6 @@ any_work (void)
         ws = &gct->gens[g];
         if (ws->todo_large_objects) return rtsTrue;
         if (!looksEmptyWSDeque(ws->todo_q)) return rtsTrue;
-        if (ws->todo_overflow) return rtsTrue;
     }
 
 #if defined(THREADED_RTS)
@@ -1063,12 +1083,15 @@ gcWorkerThread (Capability *cap)
     init_gc_thread(gct);
 
     traceEventGcWork(gct->cap);
+    perf_event_gc_start(gct);
+    perf_event_gc_phase(gct, GC_PHASE_ROOTS);
 
     // Every thread evacuates some roots.
     gct->evac_gen_no = 0;
     markCapability(mark_root, gct, cap, rtsTrue/*prune sparks*/);
     scavenge_capability_mut_lists(cap);
 
+    perf_event_gc_phase(gct, GC_PHASE_SCAVENGE);
     scavenge_until_all_done();
     
 #ifdef THREADED_RTS
@@ -1081,6 +1104,8 @@ gcWorkerThread (Capability *cap)
     pruneSparkQueue(cap);
 #endif
 
+    perf_event_gc_end(gct);
+
 #if defined(USE_PAPI) && false // PMW: Doesn't work right now...
     // count events in this thread towards the GC totals
     papi_thread_stop_gc1_count(gct->papi_events);
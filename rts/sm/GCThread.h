@@ -19,6 +19,13 @@
 
 #include "BeginPrivate.h"
 
+#ifdef USE_PERF_EVENT
+#include "rts/EventLogFormat.h" // for the GC_PHASE_* values
+
+// Counted per GC phase: cache misses and data TLB misses
+#define GC_PHASE_COUNTERS 2
+#endif
+
 /* -----------------------------------------------------------------------------
    General scheme
    
@@ -86,8 +93,6 @@ typedef struct gen_workspace_ {
     StgPtr       todo_lim;             // lim for todo_bd
 
     WSDeque *    todo_q;
-    bdescr *     todo_overflow;
-    nat          n_todo_overflow;
 
     // where large objects to be scavenged go
     bdescr *     todo_large_objects;
@@ -100,7 +105,7 @@ typedef struct gen_workspace_ {
     bdescr *     part_list;
     unsigned int n_part_blocks;      // count of above
 
-    StgWord pad[3];
+    StgWord pad[5];
 
 } gen_workspace ATTRIBUTE_ALIGNED(64);
 // align so that computing gct->gens[n] is a shift, not a multiply
@@ -172,6 +177,14 @@ typedef struct gc_thread_ {
     int papi_events;
 #endif
 
+#ifdef USE_PERF_EVENT
+    // cache and TLB misses per GC phase (+RTS -Ep), see PerfEvent.c
+    nat       gc_phase;
+    StgWord64 gc_phase_start[GC_PHASE_COUNTERS];
+    StgWord64 gc_phase_counts[NUM_GC_PHASES][GC_PHASE_COUNTERS]; // this GC
+    StgWord64 gc_phase_totals[NUM_GC_PHASES][GC_PHASE_COUNTERS]; // all GCs
+#endif
+
     // -------------------
     // stats
 
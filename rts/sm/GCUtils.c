@@ -92,15 +92,8 @@ grab_local_todo_block (gen_workspace *ws)
 {
     bdescr *bd;
 
-    bd = ws->todo_overflow;
-    if (bd != NULL)
-    {
-        ws->todo_overflow = bd->link;
-        bd->link = NULL;
-        ws->n_todo_overflow--;
-	return bd;
-    }
-
+    // NULL may also mean that we lost a race for the last few blocks;
+    // any_work() then sees that the todo_q isn't empty and we try again
     bd = popWSDeque(ws->todo_q);
     if (bd != NULL)
     {
@@ -118,10 +111,15 @@ steal_todo_block (nat g)
     nat n;
     bdescr *bd;
 
-    // look for work to steal
+    // look for work to steal, taking up to half of the victim's
+    // blocks into our own todo_q
     for (n = 0; n < n_gc_threads; n++) {
         if (n == gct->thread_index) continue;
-        bd = stealWSDeque(gc_threads[n]->gens[g].todo_q);
+        do {
+            bd = stealHalfWSDeque_(gc_threads[n]->gens[g].todo_q,
+                                   gct->gens[g].todo_q);
+        } while (bd == NULL &&
+                 !looksEmptyWSDeque(gc_threads[n]->gens[g].todo_q));
         if (bd) {
             return bd;
         }
@@ -217,11 +215,7 @@ todo_block_full (nat size, gen_workspace *ws)
                   bd->start, (unsigned long)(bd->free - bd->u.scan),
                   gen->no, dequeElements(ws->todo_q));
 
-            if (!pushWSDeque(ws->todo_q, bd)) {
-                bd->link = ws->todo_overflow;
-                ws->todo_overflow = bd;
-                ws->n_todo_overflow++;
-            }
+            pushWSDeque(ws->todo_q, bd);
         }
     }
 
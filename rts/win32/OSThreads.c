@@ -280,6 +280,14 @@ setThreadAffinity (nat n, nat m) // cap N of M
     }
 }
 
+// We don't look at the topology on Windows yet: all CPUs are taken
+// to be on the same package
+nat
+getProcessorPackage (nat cpu STG_UNUSED)
+{
+    return 0;
+}
+
 typedef BOOL (WINAPI *PCSIO)(HANDLE);
 
 void
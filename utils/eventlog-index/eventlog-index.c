@@ -0,0 +1,312 @@
+/*
+ * eventlog-index: print the index of the blocks of an eventlog, or add
+ * one to an eventlog that was written without +RTS --eventlog-index.
+ *
+ *      eventlog-index [-w] [-c <cap>] [-t <from>:<to>] <file>.eventlog
+ *
+ * For each block of events, prints its offset in the file, its
+ * capability ("-" for events of no capability) and the time span of
+ * its events in nanoseconds.  -c and -t only print the blocks of the
+ * given capability, or that overlap the given time range (in seconds,
+ * either end may be left out).  -w appends the index to the file if it
+ * doesn't have one yet.
+ *
+ * The format of the index is described in includes/rts/EventLogFormat.h.
+ */
+
+#if !defined(_WIN32)
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EVENTLOG_CONSTANTS_ONLY
+#include "rts/EventLogFormat.h"
+
+#if defined(_WIN32)
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+typedef __int64 off64;
+#else
+#include <sys/types.h>
+#define fseek64 fseeko
+#define ftell64 ftello
+typedef off_t off64;
+#endif
+
+typedef unsigned long long word64;
+
+typedef struct {
+    word64   offset;
+    word64   start;
+    word64   end;
+    unsigned capno;
+} Entry;
+
+static char   *prog;
+static char   *file;
+static FILE   *fp;
+
+static Entry  *entries  = NULL;
+static size_t  n_entries = 0;
+static size_t  max_entries = 0;
+
+static void
+die(const char *msg)
+{
+    fprintf(stderr, "%s: %s: %s\n", prog, file, msg);
+    exit(1);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "usage: %s [-w] [-c <cap>] [-t <from>:<to>] <file>.eventlog\n",
+            prog);
+    exit(1);
+}
+
+static word64
+getWord(int bytes)
+{
+    word64 w = 0;
+    int c;
+
+    while (bytes-- > 0) {
+        if ((c = getc(fp)) == EOF) {
+            die("unexpected end of file");
+        }
+        w = (w << 8) | (unsigned char)c;
+    }
+    return w;
+}
+
+static void
+skip(word64 bytes)
+{
+    if (fseek64(fp, (off64)bytes, SEEK_CUR) != 0) {
+        die("unexpected end of file");
+    }
+}
+
+static void
+addEntry(word64 offset, unsigned capno, word64 start, word64 end)
+{
+    if (n_entries == max_entries) {
+        max_entries = max_entries == 0 ? 1024 : max_entries * 2;
+        entries = realloc(entries, max_entries * sizeof(Entry));
+        if (entries == NULL) {
+            die("out of memory");
+        }
+    }
+    entries[n_entries].offset = offset;
+    entries[n_entries].capno  = capno;
+    entries[n_entries].start  = start;
+    entries[n_entries].end    = end;
+    n_entries++;
+}
+
+/* Read the index at the end of the file, if there is one. */
+static int
+readIndex(void)
+{
+    word64 offset, n, i, block;
+    unsigned capno;
+    word64 start, end;
+
+    if (fseek64(fp, -12, SEEK_END) != 0) {
+        return 0;
+    }
+    offset = getWord(8);
+    if (getWord(4) != EVENT_INDEX_END) {
+        return 0;
+    }
+
+    if (fseek64(fp, (off64)offset, SEEK_SET) != 0 ||
+        getWord(4) != EVENT_INDEX_BEGIN) {
+        die("corrupt index");
+    }
+    n = getWord(4);
+    for (i = 0; i < n; i++) {
+        block = getWord(8);
+        capno = (unsigned)getWord(2);
+        start = getWord(8);
+        end   = getWord(8);
+        addEntry(block, capno, start, end);
+    }
+    return 1;
+}
+
+/* Build the index by following the block markers from the beginning of
+   the data.  Leaves the file positioned after EVENT_DATA_END. */
+static void
+scanBlocks(void)
+{
+    word64 tag, offset, start, size, end;
+    unsigned capno;
+
+    if (fseek64(fp, 0, SEEK_SET) != 0 ||
+        getWord(4) != EVENT_HEADER_BEGIN) {
+        die("not an eventlog");
+    }
+
+    tag = getWord(4);
+    if (tag == EVENT_HEADER_FLAGS) {
+        getWord(4);
+        tag = getWord(4);
+    }
+    if (tag != EVENT_HET_BEGIN) {
+        die("corrupt header");
+    }
+
+    while ((tag = getWord(4)) == EVENT_ET_BEGIN) {
+        getWord(2);             /* event type */
+        getWord(2);             /* size */
+        skip(getWord(4));       /* description */
+        skip(getWord(4));       /* extra info */
+        if (getWord(4) != EVENT_ET_END) {
+            die("corrupt event type");
+        }
+    }
+    if (tag != EVENT_HET_END ||
+        getWord(4) != EVENT_HEADER_END ||
+        getWord(4) != EVENT_DATA_BEGIN) {
+        die("corrupt header");
+    }
+
+    for (;;) {
+        offset = (word64)ftell64(fp);
+        tag = getWord(2);
+        if (tag == EVENT_DATA_END) {
+            break;
+        }
+        if (tag != EVENT_BLOCK_MARKER) {
+            die("event outside of a block, can't index");
+        }
+        start = getWord(8);
+        size  = getWord(4);
+        end   = getWord(8);
+        capno = (unsigned)getWord(2);
+        if (size < 24) {
+            die("corrupt block marker");
+        }
+        addEntry(offset, capno, start, end);
+        skip(size - 24);
+    }
+}
+
+static void
+putWord(word64 w, int bytes)
+{
+    while (bytes-- > 0) {
+        putc((int)((w >> (8 * bytes)) & 0xff), fp);
+    }
+}
+
+/* Append the index after EVENT_DATA_END, where the file is positioned. */
+static void
+writeIndex(void)
+{
+    word64 offset;
+    size_t i;
+
+    offset = (word64)ftell64(fp);
+    /* switching from reading to writing needs a seek */
+    fseek64(fp, (off64)offset, SEEK_SET);
+
+    putWord(EVENT_INDEX_BEGIN, 4);
+    putWord(n_entries, 4);
+    for (i = 0; i < n_entries; i++) {
+        putWord(entries[i].offset, 8);
+        putWord(entries[i].capno, 2);
+        putWord(entries[i].start, 8);
+        putWord(entries[i].end, 8);
+    }
+    putWord(offset, 8);
+    putWord(EVENT_INDEX_END, 4);
+
+    if (fflush(fp) != 0 || ferror(fp)) {
+        die("can't write the index");
+    }
+}
+
+static word64
+parseTime(const char *s)
+{
+    return (word64)(atof(s) * 1e9);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int    add_index = 0;
+    long   cap = -1;
+    word64 from = 0, to = ~(word64)0;
+    char  *colon;
+    size_t i;
+    int    indexed;
+
+    prog = argv[0];
+
+    for (argc--, argv++; argc > 0 && argv[0][0] == '-'; argc--, argv++) {
+        if (strcmp(argv[0], "-w") == 0) {
+            add_index = 1;
+        } else if (strcmp(argv[0], "-c") == 0 && argc > 1) {
+            argc--, argv++;
+            cap = atol(argv[0]);
+        } else if (strcmp(argv[0], "-t") == 0 && argc > 1) {
+            argc--, argv++;
+            colon = strchr(argv[0], ':');
+            if (colon == NULL) {
+                usage();
+            }
+            if (colon != argv[0]) {
+                from = parseTime(argv[0]);
+            }
+            if (colon[1] != '\0') {
+                to = parseTime(colon + 1);
+            }
+        } else {
+            usage();
+        }
+    }
+    if (argc != 1) {
+        usage();
+    }
+    file = argv[0];
+
+    if ((fp = fopen(file, add_index ? "r+b" : "rb")) == NULL) {
+        die("can't open");
+    }
+
+    indexed = readIndex();
+    if (!indexed) {
+        scanBlocks();
+        if (add_index) {
+            writeIndex();
+        }
+    }
+
+    for (i = 0; i < n_entries; i++) {
+        if (cap >= 0 && entries[i].capno != (unsigned)cap) {
+            continue;
+        }
+        if (entries[i].end < from || entries[i].start > to) {
+            continue;
+        }
+        if (entries[i].capno == 0xffff) {
+            printf("%llu\t-\t%llu\t%llu\n",
+                   entries[i].offset, entries[i].start, entries[i].end);
+        } else {
+            printf("%llu\t%u\t%llu\t%llu\n",
+                   entries[i].offset, entries[i].capno,
+                   entries[i].start, entries[i].end);
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,19 @@
+# -----------------------------------------------------------------------------
+#
+# (c) 2009 The University of Glasgow
+#
+# This file is part of the GHC build system.
+#
+# To understand how the build system works and how to modify it, see
+#      http://hackage.haskell.org/trac/ghc/wiki/Building/Architecture
+#      http://hackage.haskell.org/trac/ghc/wiki/Building/Modifying
+#
+# -----------------------------------------------------------------------------
+
+utils/eventlog-index_dist_C_SRCS  = eventlog-index.c
+utils/eventlog-index_dist_PROG    = eventlog-index$(exeext)
+utils/eventlog-index_dist_INSTALL = YES
+
+utils/eventlog-index_CC_OPTS += -Iincludes
+
+$(eval $(call build-prog,utils/eventlog-index,dist,0))